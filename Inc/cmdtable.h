@@ -0,0 +1,50 @@
+#ifndef CMD_TABLE_H__
+#define CMD_TABLE_H__
+
+#include <stdint.h>
+
+/*
+ * Returns what the console does next: 1 to print the prompt, 2 to redraw
+ * the start screen.
+ */
+typedef uint8_t (*Cmd_Handler)(uint8_t argc, char **argv);
+
+/* One registry entry, meant to live in a const (flash) table */
+typedef struct {
+	const char *name;
+	uint32_t hash;      /* CMD_HASH(name), folded by the compiler */
+	Cmd_Handler handler;
+	const char *help;
+} Cmd;
+
+/* Longest command name CMD_HASH covers */
+#define CMD_NAME_MAX 16
+
+/*
+ * FNV-1a of a string literal of up to CMD_NAME_MAX characters, written so
+ * the compiler folds it into a constant initializer. Past the end of the
+ * name a step XORs 0 and multiplies by 1, leaving the hash unchanged.
+ */
+#define CMD_HASH(s) \
+	CMD_HASH_STEP_(CMD_HASH_STEP_(CMD_HASH_STEP_(CMD_HASH_STEP_( \
+	CMD_HASH_STEP_(CMD_HASH_STEP_(CMD_HASH_STEP_(CMD_HASH_STEP_( \
+	CMD_HASH_STEP_(CMD_HASH_STEP_(CMD_HASH_STEP_(CMD_HASH_STEP_( \
+	CMD_HASH_STEP_(CMD_HASH_STEP_(CMD_HASH_STEP_(CMD_HASH_STEP_( \
+	2166136261u, s, 0), s, 1), s, 2), s, 3), s, 4), s, 5), s, 6), s, 7), \
+	s, 8), s, 9), s, 10), s, 11), s, 12), s, 13), s, 14), s, 15)
+
+#define CMD_HASH_IN_(s, i) ((i) < sizeof(s) - 1)
+#define CMD_HASH_STEP_(h, s, i) \
+	(((h) ^ (CMD_HASH_IN_(s, i) ? (uint8_t)(s)[CMD_HASH_IN_(s, i) ? (i) : 0] : 0u)) * \
+	(CMD_HASH_IN_(s, i) ? 16777619u : 1u))
+
+/* Run-time FNV-1a, equal to CMD_HASH for the same name */
+uint32_t Cmd_Hash(const char *s);
+/*
+ * Finds the command for word: a decimal number n selects table[n - 1]
+ * directly, anything else is matched by hash and then by name. Returns
+ * NULL if nothing matches.
+ */
+const Cmd *Cmd_Find(const Cmd *table, uint8_t count, const char *word);
+
+#endif /* CMD_TABLE_H__ */
@@ -0,0 +1,35 @@
+#ifndef COBS_H__
+#define COBS_H__
+
+#include <stdint.h>
+
+/*
+ * Consistent Overhead Byte Stuffing: encoded data never contains 0x00, so
+ * 0x00 can delimit frames on a byte stream. Plain C without HAL
+ * dependencies, so host tools can link the same code as the firmware.
+ */
+
+/* Worst-case encoded size of len bytes, delimiters not included */
+#define COBS_MAX_ENCODED(len) ((len) + (len) / 254 + 1)
+
+/* Streaming encoder, for data that is not contiguous in memory */
+typedef struct {
+	uint8_t *out;
+	uint16_t codePos;   /* where the current block's code byte goes */
+	uint16_t pos;
+	uint8_t code;
+} CobsEncoder;
+
+void Cobs_EncodeBegin(CobsEncoder *enc, uint8_t *out);
+void Cobs_EncodePut(CobsEncoder *enc, uint8_t byte);
+/* Closes the last block; returns the encoded length */
+uint16_t Cobs_EncodeEnd(CobsEncoder *enc);
+
+uint16_t Cobs_Encode(const uint8_t *src, uint16_t len, uint8_t *dst);
+/*
+ * Decodes len encoded bytes (no delimiters) into dst, which may equal src.
+ * Returns the decoded length, or 0 if the input is malformed.
+ */
+uint16_t Cobs_Decode(const uint8_t *src, uint16_t len, uint8_t *dst);
+
+#endif /* COBS_H__ */
@@ -0,0 +1,56 @@
+#ifndef CRC32_H__
+#define CRC32_H__
+
+#include <stdint.h>
+
+/*
+ * CRC-32 service on the STM32F1 CRC unit. The unit only takes whole 32-bit
+ * words (poly 0x04C11DB7, init 0xFFFFFFFF, no reflection, no final XOR),
+ * so the checksum is defined as CRC-32/MPEG-2 over the data read as little
+ * endian words, followed by any 1..3 tail bytes in memory order. The tail
+ * is finished in software from the unit's result. A host build
+ * (CRC32_HW 0) computes the same value from a 1 KB table.
+ *
+ * The unit has no init register, so it holds the state of one computation
+ * at a time; a computation that finds it busy runs in software instead.
+ * Use from the main loop only.
+ */
+#ifndef CRC32_HW
+#ifdef USE_HAL_DRIVER
+#define CRC32_HW 1
+#else
+#define CRC32_HW 0
+#endif
+#endif
+
+/* Incremental computation, for data that is not contiguous in memory */
+typedef struct {
+	uint32_t crc;    /* software state, unused while hw is set */
+	uint32_t word;   /* bytes collected towards the next word */
+	uint8_t count;
+	uint8_t hw;
+} Crc32_Context;
+
+/* ok is 0 when the DMA transfer failed: crc is meaningless, try again */
+typedef void (*Crc32_Callback)(uint32_t crc, uint8_t ok);
+
+void Crc32_Init(void);
+void Crc32_Begin(Crc32_Context *ctx);
+void Crc32_Update(Crc32_Context *ctx, const uint8_t *data, uint32_t len);
+uint32_t Crc32_End(Crc32_Context *ctx);
+uint32_t Crc32_Compute(const void *data, uint32_t len);
+
+#if CRC32_HW
+/*
+ * Feeds a word-aligned buffer to the unit by memory-to-memory DMA on
+ * DMA1 channel 1, leaving the CPU free; done runs from the DMA interrupt
+ * with the result, or with ok 0 after a DMA transfer error. Worth it from
+ * a few hundred bytes on. Returns 0 without starting if the unit is busy
+ * or data is not word aligned.
+ */
+uint8_t Crc32_ComputeDMA(const void *data, uint32_t len, Crc32_Callback done);
+uint8_t Crc32_Busy(void);
+void Crc32_DMAIRQHandler(void);
+#endif
+
+#endif /* CRC32_H__ */
@@ -0,0 +1,65 @@
+#ifndef FMT_H__
+#define FMT_H__
+
+#include <stdint.h>
+
+/*
+ * Allocation-free text builder for console and telemetry output. Values
+ * are appended by type instead of through a format string, so there is
+ * nothing to mismatch at run time and no printf machinery to link. Output
+ * that does not fit is cut off; the buffer is never NUL-terminated.
+ */
+typedef struct {
+	char *buf;
+	uint16_t size;
+	uint16_t len;
+} Fmt;
+
+void Fmt_Init(Fmt *f, char *buf, uint16_t size);
+void Fmt_Char(Fmt *f, char c);
+void Fmt_Str(Fmt *f, const char *s);
+void Fmt_Uint(Fmt *f, uint32_t v);
+void Fmt_Int(Fmt *f, int32_t v);
+/* At least digits hex digits (zero padded), upper case, no prefix */
+void Fmt_Hex(Fmt *f, uint32_t v, uint8_t digits);
+/* v holds the value scaled by 10^decimals, e.g. (1234, 2) -> "12.34" */
+void Fmt_Fixed(Fmt *f, int32_t v, uint8_t decimals);
+
+/*
+ * Appends x with the routine matching its type. An unsupported type fails
+ * to compile. Character constants are int in C: cast them to char.
+ */
+#define Fmt_Put(f, x) _Generic((x), \
+	char: Fmt_Char, \
+	char*: Fmt_Str, \
+	const char*: Fmt_Str, \
+	signed char: Fmt_Int, \
+	short: Fmt_Int, \
+	int: Fmt_Int, \
+	long: Fmt_Int, \
+	unsigned char: Fmt_Uint, \
+	unsigned short: Fmt_Uint, \
+	unsigned int: Fmt_Uint, \
+	unsigned long: Fmt_Uint)((f), (x))
+
+/* Fmt_Put for each of up to 12 values in turn */
+#define Fmt_Print(f, ...) \
+	FMT_EACH_(FMT_COUNT_(__VA_ARGS__, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1))(f, __VA_ARGS__)
+
+#define FMT_COUNT_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, n, ...) n
+#define FMT_EACH_(n) FMT_EACH_CAT_(FMT_EACH_, n)
+#define FMT_EACH_CAT_(a, n) a##n
+#define FMT_EACH_1(f, x) Fmt_Put(f, x)
+#define FMT_EACH_2(f, x, ...) do { Fmt_Put(f, x); FMT_EACH_1(f, __VA_ARGS__); } while(0)
+#define FMT_EACH_3(f, x, ...) do { Fmt_Put(f, x); FMT_EACH_2(f, __VA_ARGS__); } while(0)
+#define FMT_EACH_4(f, x, ...) do { Fmt_Put(f, x); FMT_EACH_3(f, __VA_ARGS__); } while(0)
+#define FMT_EACH_5(f, x, ...) do { Fmt_Put(f, x); FMT_EACH_4(f, __VA_ARGS__); } while(0)
+#define FMT_EACH_6(f, x, ...) do { Fmt_Put(f, x); FMT_EACH_5(f, __VA_ARGS__); } while(0)
+#define FMT_EACH_7(f, x, ...) do { Fmt_Put(f, x); FMT_EACH_6(f, __VA_ARGS__); } while(0)
+#define FMT_EACH_8(f, x, ...) do { Fmt_Put(f, x); FMT_EACH_7(f, __VA_ARGS__); } while(0)
+#define FMT_EACH_9(f, x, ...) do { Fmt_Put(f, x); FMT_EACH_8(f, __VA_ARGS__); } while(0)
+#define FMT_EACH_10(f, x, ...) do { Fmt_Put(f, x); FMT_EACH_9(f, __VA_ARGS__); } while(0)
+#define FMT_EACH_11(f, x, ...) do { Fmt_Put(f, x); FMT_EACH_10(f, __VA_ARGS__); } while(0)
+#define FMT_EACH_12(f, x, ...) do { Fmt_Put(f, x); FMT_EACH_11(f, __VA_ARGS__); } while(0)
+
+#endif /* FMT_H__ */
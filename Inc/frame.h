@@ -0,0 +1,121 @@
+#ifndef FRAME_H__
+#define FRAME_H__
+
+#include <stdint.h>
+#include "cobs.h"
+#include "crc32.h"
+#include "ringbuffer.h"
+
+/*
+ * Binary machine-to-machine frames, carried on the same UART as the text
+ * console. On the wire a frame is
+ *
+ *   0x00  COBS( type | id | payload... | crc32 )  0x00
+ *
+ * The leading 0x00 switches the receiver out of text mode, which never
+ * sees a NUL from a terminal. The CRC (Crc32_Compute, little endian)
+ * covers type, id and payload. A reply carries the request's type with
+ * FRAME_REPLY set and the request's id; multi-byte payload fields are
+ * little endian.
+ */
+#define FRAME_DELIMITER   0x00
+#define FRAME_HEADER_SIZE 2
+#define FRAME_CRC_SIZE    4
+#define FRAME_MAX_PAYLOAD 128
+#define FRAME_MAX_RAW     (FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD + FRAME_CRC_SIZE)
+/* Encoded frame with both delimiters */
+#define FRAME_MAX_ENCODED (COBS_MAX_ENCODED(FRAME_MAX_RAW) + 2)
+
+/* Frame types */
+#define FRAME_PING      0x01   /* payload echoed back */
+#define FRAME_GET_STATS 0x02   /* u8 port number -> FRAME_STATS_SIZE bytes, below */
+#define FRAME_SET_BAUD  0x03   /* u8 port number, u32 baud -> u8 port number, u32 actual baud */
+#define FRAME_NACK      0x7F   /* u8 FRAME_ERR_* */
+#define FRAME_REPLY     0x80
+
+/*
+ * FRAME_GET_STATS reply payload:
+ *   u8 port, u8 mode (UART_PortMode),
+ *   u32 overrun, framing, noise, parity errors,
+ *   TX ring then RX ring: u16 highWater, u32 written, read, rejected, overflows,
+ *   u32 ISR cycles last, max, total, count
+ */
+#define FRAME_STATS_SIZE 70
+
+/*
+ * FRAME_SET_BAUD: the reply still goes out at the old rate, then the port
+ * switches. Until a valid frame or console line arrives at the new rate,
+ * or for USART1 until it has run free of errors for a while, the rate is
+ * on probation: a deadline or a burst of receive errors returns the port
+ * to the last rate that worked. The host does the same when its first
+ * request at the new rate goes unanswered.
+ */
+
+/* FRAME_NACK reasons */
+#define FRAME_ERR_CRC     1
+#define FRAME_ERR_TYPE    2
+#define FRAME_ERR_PAYLOAD 3
+
+/* Frame_Decode results */
+#define FRAME_OK        0
+#define FRAME_BAD_COBS  1
+#define FRAME_TOO_SHORT 2
+#define FRAME_BAD_CRC   3
+
+typedef struct {
+	uint8_t type;
+	uint8_t id;
+	uint8_t *payload;
+	uint16_t len;
+} Frame;
+
+/* Writes the complete frame, delimiters included, to out; returns its length */
+uint16_t Frame_Encode(const Frame *f, uint8_t *out);
+/*
+ * Decodes len COBS bytes (no delimiters) in place. On FRAME_OK, f points
+ * into buf.
+ */
+uint8_t Frame_Decode(uint8_t *buf, uint16_t len, Frame *f);
+
+static inline uint8_t *Frame_PutU16(uint8_t *p, uint16_t v) {
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	return p + 2;
+}
+
+static inline uint8_t *Frame_PutU32(uint8_t *p, uint32_t v) {
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+	return p + 4;
+}
+
+static inline uint16_t Frame_GetU16(const uint8_t *p) {
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t Frame_GetU32(const uint8_t *p) {
+	return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+#define FRAME_READER_NONE     -1   /* no complete frame yet */
+#define FRAME_READER_TOO_LONG -2   /* a frame overflowed the buffer and was dropped */
+
+/* Collects the COBS bytes of one frame, after its leading delimiter */
+typedef struct {
+	uint8_t *buf;
+	uint16_t size;
+	uint16_t len;
+	uint8_t discard;
+} FrameReader;
+
+void FrameReader_Init(FrameReader *fr, uint8_t *buf, uint16_t size);
+/*
+ * Consumes at most budget bytes from rx, up to and including the closing
+ * delimiter. Returns the encoded length of the completed frame, left in
+ * fr->buf for Frame_Decode, or one of the FRAME_READER_* codes.
+ */
+int16_t FrameReader_Poll(FrameReader *fr, RingBuffer *rx, uint16_t budget);
+
+#endif /* FRAME_H__ */
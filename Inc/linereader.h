@@ -0,0 +1,40 @@
+#ifndef LINE_READER_H__
+#define LINE_READER_H__
+
+#include <stdint.h>
+#include "ringbuffer.h"
+
+#define LINE_READER_NONE     -1   /* no complete line yet */
+#define LINE_READER_TOO_LONG -2   /* a line overflowed the buffer and was dropped */
+
+/*
+ * Assembles console lines from a RingBuffer as bytes arrive. CR, LF and
+ * CR LF all end a line, backspace/DEL edit it, tabs become blanks and
+ * other control characters are ignored. Accepted input is echoed through
+ * the optional callback.
+ */
+typedef struct {
+	char *buf;
+	uint16_t size;
+	uint16_t len;
+	uint8_t discard;    /* the current line overflowed: drop it up to the next EOL */
+	char lastEol;       /* so the LF of a CR LF pair does not end an empty line */
+	void (*echo)(const char *data, uint16_t len);
+} LineReader;
+
+void LineReader_Init(LineReader *lr, char *buf, uint16_t size,
+		void (*echo)(const char *data, uint16_t len));
+/*
+ * Consumes at most budget bytes from rx, stopping after the first line
+ * end or before a NUL at the start of a line. Returns the length of the
+ * completed line, left NUL-terminated in lr->buf until the next call, or
+ * one of the LINE_READER_* codes.
+ */
+int16_t LineReader_Poll(LineReader *lr, RingBuffer *rx, uint16_t budget);
+/*
+ * Splits line in place at blanks and stores up to maxArgs pointers to the
+ * words in argv. Returns the number of words stored.
+ */
+uint8_t LineReader_Tokenize(char *line, char **argv, uint8_t maxArgs);
+
+#endif /* LINE_READER_H__ */
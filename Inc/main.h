@@ -30,6 +30,12 @@ extern "C" {
 /* Includes ------------------------------------------------------------------*/
 #include "stm32f1xx_hal.h"
 #include "ringbuffer.h"
+#include "uart_port.h"
+#include "fmt.h"
+#include "linereader.h"
+#include "cmdtable.h"
+#include "crc32.h"
+#include "frame.h"
 #include <string.h>
 #include <stdlib.h>
 
@@ -62,7 +68,27 @@ void Error_Handler(void);
 
 /* Private defines -----------------------------------------------------------*/
 /* USER CODE BEGIN Private defines */
+/*
+ * 1: the USART2 console runs its port in UART_PORT_MODE_IRQ.
+ * 0: UART_PORT_MODE_DMA, HAL with circular DMA reception and DMA transmission.
+ */
+#ifndef USART2_FAST_IRQ
+#define USART2_FAST_IRQ 0
+#endif
 
+/*
+ * 1: RTS/CTS flow control on USART2, CTS on PA0 and RTS on PA1.
+ */
+#ifndef USART2_FLOW_CONTROL
+#define USART2_FLOW_CONTROL 0
+#endif
+/*
+ * 1: the same on USART1, CTS on PA11 and RTS on PA12. Those are the USB
+ * pins, so USB is shut down again at start-up.
+ */
+#ifndef USART1_FLOW_CONTROL
+#define USART1_FLOW_CONTROL 0
+#endif
 /* USER CODE END Private defines */
 
 #ifdef __cplusplus
@@ -0,0 +1,25 @@
+#ifndef MSG_QUEUE_H__
+#define MSG_QUEUE_H__
+
+#include <stdint.h>
+#include "ringbuffer.h"
+
+/*
+ * Queue of variable-length records on top of a RingBuffer. Each record is
+ * stored as a 16-bit little-endian length followed by the payload and only
+ * becomes visible to the reader once it is complete, so one producer (e.g.
+ * an ISR) can hand whole frames to one consumer.
+ */
+typedef struct {
+	RingBuffer ring;
+} MsgQueue;
+
+#define MSG_QUEUE_HEADER_SIZE 2
+
+void MsgQueue_Init(MsgQueue *q, uint8_t *storage, uint16_t size);
+uint8_t MsgQueue_Push(MsgQueue *q, const uint8_t *data, uint16_t len);
+uint16_t MsgQueue_NextLength(MsgQueue *q);
+uint16_t MsgQueue_Pop(MsgQueue *q, uint8_t *data, uint16_t maxLen);
+uint8_t MsgQueue_IsEmpty(MsgQueue *q);
+
+#endif //#ifndef MSG_QUEUE_H__
@@ -4,14 +4,69 @@
 #include <stdint.h>
 
 
-#define RING_BUFFER_LENGTH 1000
+/*
+ * Largest capacity any instance may use. It selects the index type: the
+ * free-running indices must be able to count up to a full buffer.
+ */
+#ifndef RING_BUFFER_MAX_LENGTH
+#define RING_BUFFER_MAX_LENGTH 32768
+#endif
 
-typedef struct {
-	uint8_t buf[RING_BUFFER_LENGTH];
-#if RING_BUFFER_LENGTH < 255
-	uint8_t head, tail;
+#if RING_BUFFER_MAX_LENGTH <= 128
+typedef uint8_t RingBuffer_Index;
+#elif RING_BUFFER_MAX_LENGTH <= 32768
+typedef uint16_t RingBuffer_Index;
 #else
-	uint16_t head, tail;
+#error "RING_BUFFER_MAX_LENGTH must not exceed 32768"
+#endif
+
+/* Define to 0 to compile the occupancy counters out of every buffer */
+#ifndef RING_BUFFER_STATS
+#define RING_BUFFER_STATS 1
+#endif
+
+/*
+ * Declares the storage for one buffer. The size must be a power of two:
+ * head and tail run freely and are masked on access.
+ */
+#define RING_BUFFER_STORAGE(name, size) \
+	_Static_assert((size) > 0 && ((size) & ((size) - 1)) == 0 && (size) <= RING_BUFFER_MAX_LENGTH, \
+			#name ": ring buffer size must be a power of two up to RING_BUFFER_MAX_LENGTH"); \
+	static uint8_t name[size]
+
+/*
+ * Same, but placed in .noinit: neither the startup code nor RingBuffer_Init
+ * clears it, so after a warm reset it still holds the last bytes that went
+ * through the buffer. Put the RingBuffer itself in .noinit as well and
+ * start it with RingBuffer_Resume to know where those bytes end.
+ */
+#define RING_BUFFER_NOINIT __attribute__((section(".noinit")))
+#define RING_BUFFER_STORAGE_NOINIT(name, size) \
+	_Static_assert((size) > 0 && ((size) & ((size) - 1)) == 0 && (size) <= RING_BUFFER_MAX_LENGTH, \
+			#name ": ring buffer size must be a power of two up to RING_BUFFER_MAX_LENGTH"); \
+	static uint8_t name[size] RING_BUFFER_NOINIT
+
+typedef struct {
+	uint16_t highWater;        /* largest fill level seen */
+	uint32_t bytesWritten;
+	uint32_t bytesRead;
+	uint32_t rejectedWrites;   /* writes refused or truncated for lack of space */
+	uint32_t overflows;        /* overwrites that had to drop old data */
+} RingBuffer_Stats;
+
+/*
+ * Single-producer/single-consumer: only the writer stores head and only the
+ * reader stores tail, so one ISR and the thread context can share a buffer
+ * without disabling interrupts.
+ */
+typedef struct {
+	uint8_t *buf;
+	uint16_t size;
+	RingBuffer_Index mask;
+	RingBuffer_Index head, tail;
+	uint32_t mpState;          /* multi-producer reservation: pending writers << 24 | 24-bit reserved position */
+#if RING_BUFFER_STATS
+	RingBuffer_Stats stats;
 #endif
 } RingBuffer;
 
@@ -23,8 +78,51 @@ typedef enum {
 
 uint16_t RingBuffer_GetDataLength(RingBuffer *buf);
 uint16_t RingBuffer_GetFreeSpace(RingBuffer *buf);
-void RingBuffer_Init(RingBuffer *buf);
+void RingBuffer_Init(RingBuffer *buf, uint8_t *storage, uint16_t size);
+/*
+ * RingBuffer_Init for a buffer whose metadata survived a warm reset in
+ * .noinit. If it still describes storage and size, head is kept and the
+ * buffer starts empty right after the old contents: the size bytes ending
+ * at head are the previous session's, oldest at storage[head & mask], and
+ * new data overwrites them oldest first. Returns 1 if it resumed, 0 after a
+ * cold boot, where it is a plain RingBuffer_Init.
+ */
+uint8_t RingBuffer_Resume(RingBuffer *buf, uint8_t *storage, uint16_t size);
 uint16_t RingBuffer_Read(RingBuffer *buf, uint8_t *data, uint16_t len);
 uint8_t RingBuffer_Write(RingBuffer *buf, uint8_t *data, uint16_t len);
+uint16_t RingBuffer_WritePartial(RingBuffer *buf, const uint8_t *data, uint16_t len);
+/* Single-byte transfers for per-byte interrupt handlers; return 0 if full/empty */
+uint8_t RingBuffer_PutByte(RingBuffer *buf, uint8_t byte);
+uint8_t RingBuffer_GetByte(RingBuffer *buf, uint8_t *byte);
+/* Moves tail as well: the reader must not run concurrently with this call */
+uint16_t RingBuffer_Overwrite(RingBuffer *buf, const uint8_t *data, uint16_t len);
+
+/*
+ * Multi-producer writers: space is reserved with an exclusive
+ * compare-and-swap (LDREX/STREX on Cortex-M3) and head only advances once
+ * every overlapping writer has finished copying, so thread and interrupt
+ * producers never mask interrupts. Once one producer of a buffer uses these,
+ * all of its producers must; the reader side is unchanged. They fill at
+ * most half the index range less one byte (32767 bytes with 16-bit
+ * indices), so a full-size buffer at RING_BUFFER_MAX_LENGTH loses a byte,
+ * and allow at most 255 writers in flight at once.
+ */
+uint8_t RingBuffer_WriteMP(RingBuffer *buf, const uint8_t *data, uint16_t len);
+uint16_t RingBuffer_WritePartialMP(RingBuffer *buf, const uint8_t *data, uint16_t len);
+
+/* Copy at an offset from tail/head without consuming or publishing anything */
+uint16_t RingBuffer_Peek(RingBuffer *buf, uint16_t offset, uint8_t *data, uint16_t len);
+void RingBuffer_Stage(RingBuffer *buf, uint16_t offset, const uint8_t *data, uint16_t len);
+
+/* Zero-copy access: largest contiguous region, then consume/commit it */
+uint16_t RingBuffer_GetReadRegion(RingBuffer *buf, uint8_t **data);
+void RingBuffer_Consume(RingBuffer *buf, uint16_t len);
+uint16_t RingBuffer_GetWriteRegion(RingBuffer *buf, uint8_t **data);
+void RingBuffer_Commit(RingBuffer *buf, uint16_t len);
+
+#if RING_BUFFER_STATS
+void RingBuffer_GetStats(RingBuffer *buf, RingBuffer_Stats *stats);
+void RingBuffer_ResetStats(RingBuffer *buf);
+#endif
 
 #endif //#ifndef RING_BUFFER_H__
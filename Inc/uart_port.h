@@ -0,0 +1,163 @@
+#ifndef UART_PORT_H__
+#define UART_PORT_H__
+
+#include "stm32f1xx_hal.h"
+#include "ringbuffer.h"
+
+/* What a write does when the TX ring cannot take the whole message */
+#define TX_POLICY_REJECT  0   /* drop the whole message */
+#define TX_POLICY_PARTIAL 1   /* queue what fits, drop the rest */
+#define TX_POLICY_BLOCK   2   /* wait up to TX_BLOCK_TIMEOUT ms for the port to drain its TX ring */
+
+#ifndef TX_POLICY
+#define TX_POLICY TX_POLICY_BLOCK
+#endif
+#define TX_BLOCK_TIMEOUT 20
+
+/* How many ports the HAL callbacks can dispatch to */
+#ifndef UART_PORT_MAX
+#define UART_PORT_MAX 2
+#endif
+
+/* 1: measure every port's interrupt handler with the DWT cycle counter */
+#ifndef UART_ISR_PROFILE
+#define UART_ISR_PROFILE 1
+#endif
+
+typedef enum {
+	/* HAL_UART_IRQHandler with circular DMA reception and DMA transmission */
+	UART_PORT_MODE_DMA = 0,
+	/* Register-level interrupt handler moving one byte at a time between SR/DR and the rings */
+	UART_PORT_MODE_IRQ
+} UART_PortMode;
+
+typedef struct {
+	uint32_t overrun;
+	uint32_t framing;
+	uint32_t noise;
+	uint32_t parity;
+} UART_ErrorCounters;
+
+/* DWT cycle counts of an interrupt handler */
+typedef struct {
+	uint32_t last;
+	uint32_t max;
+	uint32_t total;
+	uint32_t count;
+} ISR_CycleStats;
+
+/* Traffic one port received while bridged to another */
+typedef struct {
+	uint32_t rxBytes;   /* landed in the RX DMA buffer */
+	uint32_t txBytes;   /* sent out of the peer */
+	uint32_t dropped;   /* overwritten by the RX DMA before the peer could send them */
+} UART_BridgeStats;
+
+/*
+ * RTS/CTS flow control. CTS is the USART's own (CR3 CTSE): the transmitter
+ * holds off while the peer deasserts it. RTS is a GPIO driven from the RX
+ * ring fill level, because the hardware RTS only reflects the data
+ * register, which the RX DMA empties at once. Both lines are active low.
+ */
+typedef struct {
+	GPIO_TypeDef *rtsPort;   /* NULL: flow control off */
+	uint16_t rtsPin;
+	uint16_t stopLevel;      /* rx fill that deasserts RTS */
+	uint16_t resumeLevel;    /* rx fill that asserts it again */
+	__IO uint8_t stopped;
+	uint32_t stops;          /* times RTS was deasserted */
+} UART_FlowControl;
+
+/*
+ * Interrupt/DMA driven UART. Each port wraps a HAL UART handle with its own
+ * TX and RX ring buffers, so every USART on the chip runs the same engine.
+ */
+typedef struct UART_Port {
+	UART_HandleTypeDef *huart;
+	UART_PortMode mode;
+	RingBuffer tx;
+	RingBuffer rx;
+	/* Circular DMA target, drained into rx (DMA mode only) */
+	uint8_t *rxDma;
+	uint16_t rxDmaSize;
+	uint16_t rxDmaPos;
+	/* Bytes of tx the in-flight DMA transfer reads in place (0 for a constant) */
+	__IO uint16_t txLen;
+	__IO uint8_t txBusy;
+	UART_ErrorCounters errors;
+	ISR_CycleStats isrCycles;
+	/* While bridged: the port that sends what this one receives, and vice versa */
+	struct UART_Port *bridge;
+	/* rxDma bytes not yet handed to the peer, and those its DMA is sending now */
+	uint16_t bridgePending;
+	uint16_t bridgeInFlight;
+	UART_BridgeStats bridgeStats;
+	UART_FlowControl flow;
+} UART_Port;
+
+/*
+ * Binds port to huart and its ring storage. DMA mode needs both DMA
+ * handles linked to huart, otherwise the port falls back to IRQ mode.
+ * rxDma may be NULL in IRQ mode. A port placed in .noinit with its
+ * txStorage keeps the output from before a warm reset behind tx.head
+ * (see RingBuffer_Resume); new output follows it and none of it is resent.
+ */
+void UART_Port_Init(UART_Port *port, UART_HandleTypeDef *huart, UART_PortMode mode,
+		uint8_t *txStorage, uint16_t txSize, uint8_t *rxStorage, uint16_t rxSize,
+		uint8_t *rxDma, uint16_t rxDmaSize);
+/* Arms reception; call once the USART interrupt is enabled */
+void UART_Port_Start(UART_Port *port);
+/*
+ * Copies the message into the TX ring and returns at once, so the caller
+ * may reuse data immediately. Safe from the main loop and from interrupt
+ * handlers, though handlers should not rely on TX_POLICY_BLOCK.
+ */
+uint8_t UART_Port_Write(UART_Port *port, const uint8_t *data, uint16_t len);
+/* UART_Port_Write with an explicit TX_POLICY_*; returns the bytes queued */
+uint16_t UART_Port_WritePolicy(UART_Port *port, const uint8_t *data, uint16_t len, uint8_t policy);
+/* For data that outlives the transfer: sent in place when the port is idle */
+uint8_t UART_Port_WriteConst(UART_Port *port, const uint8_t *data, uint16_t len);
+uint16_t UART_Port_Read(UART_Port *port, uint8_t *data, uint16_t len);
+/* Starts sending queued output unless a transfer is already in flight */
+void UART_Port_KickTx(UART_Port *port);
+/* 1 once all queued output has left the shift register; never waits */
+uint8_t UART_Port_TxDone(UART_Port *port);
+/* Highest rate the port's bus clock allows with 16x oversampling */
+uint32_t UART_Port_MaxBaud(UART_Port *port);
+/* The rate BRR would yield for baud, or 0 if it is out of range */
+uint32_t UART_Port_CheckBaud(UART_Port *port, uint32_t baud);
+/*
+ * Reprograms BRR from the bus clock SystemClock_Config set up, leaving the
+ * rings and the RX DMA running. Anything still being shifted is garbled,
+ * so wait for UART_Port_TxDone first. Returns the rate BRR actually
+ * yields, or 0 if baud is out of range.
+ */
+uint32_t UART_Port_SetBaud(UART_Port *port, uint32_t baud);
+/* The rate BRR currently yields */
+uint32_t UART_Port_GetBaud(UART_Port *port);
+/*
+ * Turns on hardware CTS and RTS on rtsPin, a push-pull output. RTS drops
+ * once rx holds threshold bytes and returns at half that. The room above
+ * threshold must cover what arrives before the peer reacts, plus half of
+ * rxDma in DMA mode, which reaches rx in half-buffer steps.
+ */
+void UART_Port_SetFlowControl(UART_Port *port, GPIO_TypeDef *rtsPort, uint16_t rtsPin, uint16_t threshold);
+/*
+ * Reasserts RTS once the reader has drained rx. Consumers read rx directly,
+ * so call this from the main loop after them.
+ */
+void UART_Port_PollFlow(UART_Port *port);
+/* Body of the USARTx_IRQHandler of a port */
+void UART_Port_IRQHandler(UART_Port *port);
+UART_Port *UART_Port_Find(UART_HandleTypeDef *huart);
+/*
+ * Forwards everything a receives out of b and vice versa. Each port's TX
+ * DMA reads straight out of the peer's circular RX DMA buffer, so nothing
+ * is copied and the TX/RX rings are bypassed until UART_Port_BridgeStop.
+ * Both ports must run in DMA mode: returns HAL_ERROR if they do not, and
+ * HAL_TIMEOUT if queued output did not drain within TX_BLOCK_TIMEOUT.
+ */
+HAL_StatusTypeDef UART_Port_BridgeStart(UART_Port *a, UART_Port *b);
+void UART_Port_BridgeStop(UART_Port *a, UART_Port *b);
+
+#endif /* UART_PORT_H__ */
@@ -0,0 +1,31 @@
+#include "cmdtable.h"
+#include <stddef.h>
+#include <string.h>
+
+uint32_t Cmd_Hash(const char *s) {
+	uint32_t h = 2166136261u;
+
+	while(*s != '\0')
+		h = (h ^ (uint8_t)*s++) * 16777619u;
+	return h;
+}
+
+const Cmd *Cmd_Find(const Cmd *table, uint8_t count, const char *word) {
+	const char *p = word;
+	uint32_t n = 0;
+	uint32_t h;
+	uint8_t i;
+
+	while(*p >= '0' && *p <= '9' && n <= count)
+		n = n * 10 + (uint32_t)(*p++ - '0');
+	if(p != word && *p == '\0')
+		return n >= 1 && n <= count ? &table[n - 1] : NULL;
+
+	/* Names are compared only when the 32-bit hashes agree */
+	h = Cmd_Hash(word);
+	for(i = 0; i < count; i++) {
+		if(table[i].hash == h && strcmp(table[i].name, word) == 0)
+			return &table[i];
+	}
+	return NULL;
+}
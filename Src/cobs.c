@@ -0,0 +1,52 @@
+#include "cobs.h"
+
+void Cobs_EncodeBegin(CobsEncoder *enc, uint8_t *out) {
+	enc->out = out;
+	enc->codePos = 0;
+	enc->pos = 1;
+	enc->code = 1;
+}
+
+void Cobs_EncodePut(CobsEncoder *enc, uint8_t byte) {
+	if(byte != 0)
+		enc->out[enc->pos++] = byte;
+
+	/* A zero ends the block; so does a full one, which carries no implied zero */
+	if(byte == 0 || ++enc->code == 0xFF) {
+		enc->out[enc->codePos] = byte == 0 ? enc->code : 0xFF;
+		enc->codePos = enc->pos++;
+		enc->code = 1;
+	}
+}
+
+uint16_t Cobs_EncodeEnd(CobsEncoder *enc) {
+	enc->out[enc->codePos] = enc->code;
+	return enc->pos;
+}
+
+uint16_t Cobs_Encode(const uint8_t *src, uint16_t len, uint8_t *dst) {
+	CobsEncoder enc;
+
+	Cobs_EncodeBegin(&enc, dst);
+	while(len-- > 0)
+		Cobs_EncodePut(&enc, *src++);
+	return Cobs_EncodeEnd(&enc);
+}
+
+uint16_t Cobs_Decode(const uint8_t *src, uint16_t len, uint8_t *dst) {
+	const uint8_t *end = src + len;
+	uint16_t out = 0;
+	uint8_t code, i;
+
+	while(src < end) {
+		code = *src++;
+		if(code == 0 || src + code - 1 > end)
+			return 0;
+		for(i = 1; i < code; i++)
+			dst[out++] = *src++;
+		/* Every block but a full one or the last stands for a zero */
+		if(code != 0xFF && src < end)
+			dst[out++] = 0;
+	}
+	return out;
+}
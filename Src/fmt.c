@@ -0,0 +1,79 @@
+#include "fmt.h"
+
+static const char hexDigits[] = "0123456789ABCDEF";
+
+void Fmt_Init(Fmt *f, char *buf, uint16_t size) {
+	f->buf = buf;
+	f->size = size;
+	f->len = 0;
+}
+
+void Fmt_Char(Fmt *f, char c) {
+	if(f->len < f->size)
+		f->buf[f->len++] = c;
+}
+
+void Fmt_Str(Fmt *f, const char *s) {
+	while(*s != '\0' && f->len < f->size)
+		f->buf[f->len++] = *s++;
+}
+
+/* Digits come out least significant first, so they are staged backwards */
+void Fmt_Uint(Fmt *f, uint32_t v) {
+	char tmp[10];
+	uint8_t n = 0;
+
+	do {
+		tmp[n++] = (char)('0' + v % 10);
+		v /= 10;
+	} while(v != 0);
+
+	while(n > 0)
+		Fmt_Char(f, tmp[--n]);
+}
+
+void Fmt_Int(Fmt *f, int32_t v) {
+	if(v < 0) {
+		Fmt_Char(f, '-');
+		Fmt_Uint(f, 0u - (uint32_t)v);
+	} else {
+		Fmt_Uint(f, (uint32_t)v);
+	}
+}
+
+void Fmt_Hex(Fmt *f, uint32_t v, uint8_t digits) {
+	int8_t shift;
+
+	if(digits > 8)
+		digits = 8;
+	/* Skip leading zero nibbles beyond the requested width */
+	for(shift = 28; shift > 0 && shift >= digits * 4 && (v >> shift) == 0; shift -= 4)
+		;
+	for(; shift >= 0; shift -= 4)
+		Fmt_Char(f, hexDigits[(v >> shift) & 0xF]);
+}
+
+void Fmt_Fixed(Fmt *f, int32_t v, uint8_t decimals) {
+	char tmp[10];
+	uint32_t u;
+	uint8_t n = 0;
+
+	if(v < 0) {
+		Fmt_Char(f, '-');
+		u = 0u - (uint32_t)v;
+	} else {
+		u = (uint32_t)v;
+	}
+
+	/* Fraction digits first, zero padded to the requested width */
+	while(n < decimals && n < sizeof(tmp)) {
+		tmp[n++] = (char)('0' + u % 10);
+		u /= 10;
+	}
+	Fmt_Uint(f, u);
+	if(n > 0) {
+		Fmt_Char(f, '.');
+		while(n > 0)
+			Fmt_Char(f, tmp[--n]);
+	}
+}
@@ -0,0 +1,82 @@
+#include "frame.h"
+
+/* The raw frame is streamed through the encoder, so it never exists unencoded */
+uint16_t Frame_Encode(const Frame *f, uint8_t *out) {
+	CobsEncoder enc;
+	Crc32_Context ctx;
+	uint8_t header[FRAME_HEADER_SIZE] = { f->type, f->id };
+	uint8_t crc[FRAME_CRC_SIZE];
+	uint16_t i, len;
+
+	Crc32_Begin(&ctx);
+	Crc32_Update(&ctx, header, sizeof(header));
+	Crc32_Update(&ctx, f->payload, f->len);
+	Frame_PutU32(crc, Crc32_End(&ctx));
+
+	out[0] = FRAME_DELIMITER;
+	Cobs_EncodeBegin(&enc, out + 1);
+	Cobs_EncodePut(&enc, f->type);
+	Cobs_EncodePut(&enc, f->id);
+	for(i = 0; i < f->len; i++)
+		Cobs_EncodePut(&enc, f->payload[i]);
+	for(i = 0; i < FRAME_CRC_SIZE; i++)
+		Cobs_EncodePut(&enc, crc[i]);
+	len = Cobs_EncodeEnd(&enc) + 1;
+	out[len++] = FRAME_DELIMITER;
+	return len;
+}
+
+uint8_t Frame_Decode(uint8_t *buf, uint16_t len, Frame *f) {
+	uint16_t raw = Cobs_Decode(buf, len, buf);
+
+	if(raw == 0)
+		return FRAME_BAD_COBS;
+	if(raw < FRAME_HEADER_SIZE + FRAME_CRC_SIZE)
+		return FRAME_TOO_SHORT;
+	raw -= FRAME_CRC_SIZE;
+	if(Crc32_Compute(buf, raw) != Frame_GetU32(&buf[raw]))
+		return FRAME_BAD_CRC;
+
+	f->type = buf[0];
+	f->id = buf[1];
+	f->payload = &buf[FRAME_HEADER_SIZE];
+	f->len = raw - FRAME_HEADER_SIZE;
+	return FRAME_OK;
+}
+
+void FrameReader_Init(FrameReader *fr, uint8_t *buf, uint16_t size) {
+	fr->buf = buf;
+	fr->size = size;
+	fr->len = 0;
+	fr->discard = 0;
+}
+
+int16_t FrameReader_Poll(FrameReader *fr, RingBuffer *rx, uint16_t budget) {
+	uint16_t avail, i;
+	uint8_t *data;
+	int16_t result = FRAME_READER_NONE;
+
+	while(budget > 0 && result == FRAME_READER_NONE) {
+		avail = RingBuffer_GetReadRegion(rx, &data);
+		if(avail == 0)
+			break;
+		if(avail > budget)
+			avail = budget;
+
+		for(i = 0; i < avail && result == FRAME_READER_NONE; i++) {
+			if(data[i] == FRAME_DELIMITER) {
+				result = fr->discard ? FRAME_READER_TOO_LONG : (int16_t)fr->len;
+				fr->len = 0;
+				fr->discard = 0;
+			} else if(fr->len < fr->size) {
+				fr->buf[fr->len++] = data[i];
+			} else {
+				fr->discard = 1;
+			}
+		}
+
+		RingBuffer_Consume(rx, i);
+		budget -= i;
+	}
+	return result;
+}
@@ -0,0 +1,117 @@
+#include "linereader.h"
+#include <stddef.h>
+
+/* Accepted input is echoed in batches of this size rather than per byte */
+#define ECHO_CHUNK 32
+
+void LineReader_Init(LineReader *lr, char *buf, uint16_t size,
+		void (*echo)(const char *data, uint16_t len)) {
+	lr->buf = buf;
+	lr->size = size;
+	lr->len = 0;
+	lr->discard = 0;
+	lr->lastEol = 0;
+	lr->echo = echo;
+}
+
+static void echoFlush(LineReader *lr, char *pending, uint16_t *n) {
+	if(*n > 0 && lr->echo != NULL)
+		lr->echo(pending, *n);
+	*n = 0;
+}
+
+static void echoPut(LineReader *lr, char *pending, uint16_t *n, const char *data, uint16_t len) {
+	while(len-- > 0) {
+		if(*n == ECHO_CHUNK)
+			echoFlush(lr, pending, n);
+		pending[(*n)++] = *data++;
+	}
+}
+
+int16_t LineReader_Poll(LineReader *lr, RingBuffer *rx, uint16_t budget) {
+	char pending[ECHO_CHUNK];
+	uint16_t echoed = 0;
+	uint16_t avail, i;
+	uint8_t *data;
+	int16_t result = LINE_READER_NONE;
+	uint8_t stop = 0;
+	char c;
+
+	/* Bytes are parsed straight out of the ring, one contiguous region at a time */
+	while(budget > 0 && result == LINE_READER_NONE && !stop) {
+		avail = RingBuffer_GetReadRegion(rx, &data);
+		if(avail == 0)
+			break;
+		if(avail > budget)
+			avail = budget;
+
+		for(i = 0; i < avail && result == LINE_READER_NONE; i++) {
+			c = (char)data[i];
+			/* A NUL opening a line belongs to a binary frame: leave it for the caller */
+			if(c == '\0' && lr->len == 0) {
+				stop = 1;
+				break;
+			}
+			if(c == '\r' || c == '\n') {
+				if(c == '\n' && lr->lastEol == '\r') {
+					lr->lastEol = 0;
+					continue;
+				}
+				lr->lastEol = c;
+				echoPut(lr, pending, &echoed, "\r\n", 2);
+				if(lr->discard) {
+					result = LINE_READER_TOO_LONG;
+				} else {
+					lr->buf[lr->len] = '\0';
+					result = lr->len;
+				}
+				lr->len = 0;
+				lr->discard = 0;
+				continue;
+			}
+
+			lr->lastEol = 0;
+			if(c == '\t')
+				c = ' ';
+			if(c == '\b' || c == 0x7F) {
+				if(lr->len > 0) {
+					lr->len--;
+					echoPut(lr, pending, &echoed, "\b \b", 3);
+				}
+			} else if((uint8_t)c >= ' ') {
+				/* One byte stays free for the terminator */
+				if(lr->len + 1 < lr->size) {
+					lr->buf[lr->len++] = c;
+					echoPut(lr, pending, &echoed, &c, 1);
+				} else {
+					lr->discard = 1;
+				}
+			}
+		}
+
+		RingBuffer_Consume(rx, i);
+		budget -= i;
+	}
+
+	echoFlush(lr, pending, &echoed);
+	return result;
+}
+
+uint8_t LineReader_Tokenize(char *line, char **argv, uint8_t maxArgs) {
+	uint8_t argc = 0;
+
+	while(argc < maxArgs) {
+		while(*line == ' ' || *line == '\t')
+			line++;
+		if(*line == '\0')
+			break;
+
+		argv[argc++] = line;
+		while(*line != '\0' && *line != ' ' && *line != '\t')
+			line++;
+		if(*line == '\0')
+			break;
+		*line++ = '\0';
+	}
+	return argc;
+}
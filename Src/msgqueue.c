@@ -0,0 +1,50 @@
+#include "msgqueue.h"
+
+void MsgQueue_Init(MsgQueue *q, uint8_t *storage, uint16_t size) {
+	RingBuffer_Init(&q->ring, storage, size);
+}
+
+/* Returns RING_BUFFER_OK, or the reason the whole record did not fit */
+uint8_t MsgQueue_Push(MsgQueue *q, const uint8_t *data, uint16_t len) {
+	uint8_t header[MSG_QUEUE_HEADER_SIZE] = { len & 0xFF, len >> 8 };
+	uint16_t freeSpace = RingBuffer_GetFreeSpace(&q->ring);
+
+	if(len == 0 || len > UINT16_MAX - MSG_QUEUE_HEADER_SIZE)
+		return RING_BUFFER_NO_SUFFICIENT_SPACE;
+	if(freeSpace < len + MSG_QUEUE_HEADER_SIZE)
+		return freeSpace == 0 ? RING_BUFFER_FULL : RING_BUFFER_NO_SUFFICIENT_SPACE;
+
+	RingBuffer_Stage(&q->ring, 0, header, MSG_QUEUE_HEADER_SIZE);
+	RingBuffer_Stage(&q->ring, MSG_QUEUE_HEADER_SIZE, data, len);
+	RingBuffer_Commit(&q->ring, len + MSG_QUEUE_HEADER_SIZE);
+	return RING_BUFFER_OK;
+}
+
+/* Payload length of the oldest record, 0 when the queue is empty */
+uint16_t MsgQueue_NextLength(MsgQueue *q) {
+	uint8_t header[MSG_QUEUE_HEADER_SIZE];
+
+	if(RingBuffer_Peek(&q->ring, 0, header, MSG_QUEUE_HEADER_SIZE) != MSG_QUEUE_HEADER_SIZE)
+		return 0;
+	return header[0] | (header[1] << 8);
+}
+
+/*
+ * Removes the oldest record and returns its length, 0 when the queue is
+ * empty. A record longer than maxLen is truncated to maxLen bytes.
+ */
+uint16_t MsgQueue_Pop(MsgQueue *q, uint8_t *data, uint16_t maxLen) {
+	uint16_t len = MsgQueue_NextLength(q);
+	uint16_t copied;
+
+	if(len == 0)
+		return 0;
+
+	copied = RingBuffer_Peek(&q->ring, MSG_QUEUE_HEADER_SIZE, data, len < maxLen ? len : maxLen);
+	RingBuffer_Consume(&q->ring, len + MSG_QUEUE_HEADER_SIZE);
+	return copied;
+}
+
+uint8_t MsgQueue_IsEmpty(MsgQueue *q) {
+	return RingBuffer_GetDataLength(&q->ring) == 0;
+}
@@ -1,48 +1,425 @@
 #include "ringbuffer.h"
 #include <string.h>
 
-uint16_t RingBuffer_GetFreeSpace(RingBuffer *buf) {
-	if(buf->tail == buf->head)
-		return RING_BUFFER_LENGTH - 1;
+/*
+ * The index owned by the other side is loaded with acquire semantics and our
+ * own index is published with release semantics, so the payload bytes are
+ * always visible before the index that covers them.
+ */
+#define RB_LOAD_ACQUIRE(idx)       __atomic_load_n(&(idx), __ATOMIC_ACQUIRE)
+#define RB_STORE_RELEASE(idx, val) __atomic_store_n(&(idx), (val), __ATOMIC_RELEASE)
+
+#if RING_BUFFER_STATS
+#define RB_STAT(stmt) do { stmt; } while(0)
+#else
+#define RB_STAT(stmt) do { } while(0)
+#endif
+
+/* Called by the writer once the bytes behind head are in place */
+static inline void publishHead(RingBuffer *buf, RingBuffer_Index head, uint16_t len) {
+	head += len;
+	RB_STORE_RELEASE(buf->head, head);
+#if RING_BUFFER_STATS
+	uint16_t used = (RingBuffer_Index)(head - buf->tail);
+
+	if(used > buf->stats.highWater)
+		buf->stats.highWater = used;
+	buf->stats.bytesWritten += len;
+#endif
+}
+
+/* Called by the reader once the bytes before tail have been used */
+static inline void publishTail(RingBuffer *buf, RingBuffer_Index tail, uint16_t len) {
+	RB_STORE_RELEASE(buf->tail, (RingBuffer_Index)(tail + len));
+	RB_STAT(buf->stats.bytesRead += len);
+}
+
+/*
+ * A transfer touches at most two contiguous segments: up to the end of the
+ * storage array and then from its start. memcpy moves each of them with
+ * word-wide accesses instead of one byte per iteration. A few bytes are
+ * cheaper copied inline than through the memcpy call, so only that loop is
+ * inlined into the callers and the segmented copy stays out of line.
+ */
+#define RB_SHORT_COPY 8
+
+static void copyInSegments(RingBuffer *buf, RingBuffer_Index pos, const uint8_t *data, uint16_t len) {
+	uint16_t offset = pos & buf->mask;
+	uint16_t first = buf->size - offset;
+
+	if(first > len)
+		first = len;
+	memcpy(&buf->buf[offset], data, first);
+	if(len > first)
+		memcpy(&buf->buf[0], data + first, len - first);
+}
+
+static void copyOutSegments(RingBuffer *buf, RingBuffer_Index pos, uint8_t *data, uint16_t len) {
+	uint16_t offset = pos & buf->mask;
+	uint16_t first = buf->size - offset;
 
-	if(buf->head > buf->tail)
-		return RING_BUFFER_LENGTH - ((buf->head - buf->tail) + 1);
-	else
-		return  (buf->tail - buf->head) - 1;
+	if(first > len)
+		first = len;
+	memcpy(data, &buf->buf[offset], first);
+	if(len > first)
+		memcpy(data + first, &buf->buf[0], len - first);
+}
+
+static inline void copyIn(RingBuffer *buf, RingBuffer_Index pos, const uint8_t *data, uint16_t len) {
+	uint8_t *storage;
+	RingBuffer_Index mask;
+
+	if(len > RB_SHORT_COPY) {
+		copyInSegments(buf, pos, data, len);
+		return;
+	}
+	/* Locals, so the stores through storage do not force a reload of buf */
+	storage = buf->buf;
+	mask = buf->mask;
+	while(len--)
+		storage[pos++ & mask] = *data++;
+}
+
+static inline void copyOut(RingBuffer *buf, RingBuffer_Index pos, uint8_t *data, uint16_t len) {
+	const uint8_t *storage;
+	RingBuffer_Index mask;
+
+	if(len > RB_SHORT_COPY) {
+		copyOutSegments(buf, pos, data, len);
+		return;
+	}
+	storage = buf->buf;
+	mask = buf->mask;
+	while(len--)
+		*data++ = storage[pos++ & mask];
+}
+
+uint16_t RingBuffer_GetFreeSpace(RingBuffer *buf) {
+	return buf->size - RingBuffer_GetDataLength(buf);
 }
 
 uint16_t RingBuffer_GetDataLength(RingBuffer *buf) {
-	return RING_BUFFER_LENGTH - (RingBuffer_GetFreeSpace(buf) + 1);
+	RingBuffer_Index head = RB_LOAD_ACQUIRE(buf->head);
+	RingBuffer_Index tail = RB_LOAD_ACQUIRE(buf->tail);
+
+	return (RingBuffer_Index)(head - tail);
 }
 
 
-void RingBuffer_Init(RingBuffer *buf) {
+/* Only the metadata is reset: stale bytes in storage are never read back */
+void RingBuffer_Init(RingBuffer *buf, uint8_t *storage, uint16_t size) {
+	buf->buf = storage;
+	buf->size = size;
+	buf->mask = size - 1;
 	buf->head = buf->tail = 0;
-	memset(buf->buf, 0, RING_BUFFER_LENGTH);
+	buf->mpState = 0;
+	RB_STAT(memset(&buf->stats, 0, sizeof(buf->stats)));
 }
 
-uint16_t RingBuffer_Read(RingBuffer *buf, uint8_t *data, uint16_t len) {
-	uint16_t counter = 0;
+/*
+ * After a cold boot the metadata is whatever SRAM powered up with: resume
+ * only if it points at this storage with this size and holds no more than
+ * size bytes. A multi-producer write the reset cut short never moved head,
+ * so its bytes are simply after the kept ones and get overwritten.
+ */
+uint8_t RingBuffer_Resume(RingBuffer *buf, uint8_t *storage, uint16_t size) {
+	RingBuffer_Index head = buf->head;
 
-	while(buf->tail != buf->head && counter < len) {
-		data[counter++] = buf->buf[buf->tail];
-		buf->tail = (buf->tail + 1) % RING_BUFFER_LENGTH;
+	if(buf->buf != storage || buf->size != size || buf->mask != (RingBuffer_Index)(size - 1) ||
+			(RingBuffer_Index)(head - buf->tail) > size) {
+		RingBuffer_Init(buf, storage, size);
+		return 0;
 	}
-	return counter;
+
+	buf->tail = head;
+	buf->mpState = head;
+	RB_STAT(memset(&buf->stats, 0, sizeof(buf->stats)));
+	return 1;
 }
 
-uint8_t RingBuffer_Write(RingBuffer *buf, uint8_t *data, uint16_t len) {
-	uint16_t counter = 0;
-	uint16_t freeSpace = RingBuffer_GetFreeSpace(buf);
+uint16_t RingBuffer_Read(RingBuffer *buf, uint8_t *data, uint16_t len) {
+	RingBuffer_Index tail = buf->tail;
+	uint16_t available = (RingBuffer_Index)(RB_LOAD_ACQUIRE(buf->head) - tail);
+
+	if(len > available)
+		len = available;
+	if(len == 0)
+		return 0;
+
+	copyOut(buf, tail, data, len);
+	publishTail(buf, tail, len);
+	return len;
+}
 
-	if(freeSpace == 0)
-		return RING_BUFFER_FULL;
-	else if (freeSpace < len)
-		return RING_BUFFER_NO_SUFFICIENT_SPACE;
+uint8_t RingBuffer_Write(RingBuffer *buf, uint8_t *data, uint16_t len) {
+	RingBuffer_Index head = buf->head;
+	uint16_t freeSpace = buf->size - (RingBuffer_Index)(head - RB_LOAD_ACQUIRE(buf->tail));
 
-	while(counter < len) {
-		buf->buf[buf->head] = data[counter++];
-		buf->head = (buf->head + 1) % RING_BUFFER_LENGTH;
+	if(freeSpace == 0 || freeSpace < len) {
+		RB_STAT(buf->stats.rejectedWrites++);
+		return freeSpace == 0 ? RING_BUFFER_FULL : RING_BUFFER_NO_SUFFICIENT_SPACE;
 	}
+
+	copyIn(buf, head, data, len);
+	publishHead(buf, head, len);
  	return RING_BUFFER_OK;
 }
+
+uint8_t RingBuffer_PutByte(RingBuffer *buf, uint8_t byte) {
+	RingBuffer_Index head = buf->head;
+
+	if((RingBuffer_Index)(head - RB_LOAD_ACQUIRE(buf->tail)) == buf->size) {
+		RB_STAT(buf->stats.rejectedWrites++);
+		return 0;
+	}
+
+	buf->buf[head & buf->mask] = byte;
+	publishHead(buf, head, 1);
+	return 1;
+}
+
+uint8_t RingBuffer_GetByte(RingBuffer *buf, uint8_t *byte) {
+	RingBuffer_Index tail = buf->tail;
+
+	if(RB_LOAD_ACQUIRE(buf->head) == tail)
+		return 0;
+
+	*byte = buf->buf[tail & buf->mask];
+	publishTail(buf, tail, 1);
+	return 1;
+}
+
+/* Writes as much of data as fits and returns how many bytes were taken */
+uint16_t RingBuffer_WritePartial(RingBuffer *buf, const uint8_t *data, uint16_t len) {
+	RingBuffer_Index head = buf->head;
+	uint16_t freeSpace = buf->size - (RingBuffer_Index)(head - RB_LOAD_ACQUIRE(buf->tail));
+
+	if(len > freeSpace) {
+		RB_STAT(buf->stats.rejectedWrites++);
+		len = freeSpace;
+	}
+	if(len == 0)
+		return 0;
+
+	copyIn(buf, head, data, len);
+	publishHead(buf, head, len);
+	return len;
+}
+
+/*
+ * Always accepts the newest data, discarding the oldest bytes to make room.
+ * Returns how many previously stored bytes were dropped.
+ */
+uint16_t RingBuffer_Overwrite(RingBuffer *buf, const uint8_t *data, uint16_t len) {
+	RingBuffer_Index head = buf->head;
+	RingBuffer_Index tail = buf->tail;
+	uint16_t used = (RingBuffer_Index)(head - tail);
+	uint16_t dropped = 0;
+
+	if(len > buf->size) {
+		data += len - buf->size;
+		len = buf->size;
+	}
+	if(len > buf->size - used) {
+		dropped = len - (buf->size - used);
+		RB_STORE_RELEASE(buf->tail, (RingBuffer_Index)(tail + dropped));
+		RB_STAT(buf->stats.overflows++);
+	}
+
+	copyIn(buf, head, data, len);
+	publishHead(buf, head, len);
+	return dropped;
+}
+
+/*
+ * Host stress tests define this to a function that yields, to widen the
+ * races between reserving, copying and committing; nothing on target.
+ */
+#ifdef RING_BUFFER_MP_HOOK
+void RING_BUFFER_MP_HOOK(void);
+#else
+#define RING_BUFFER_MP_HOOK() do { } while(0)
+#endif
+
+/*
+ * mpState packs the pending writers into the top 8 bits and a 24-bit
+ * reserved position below them; the index is its low bits. The position
+ * runs ahead of the index so a CAS cannot mistake a state that wrapped all
+ * the way round for the one it loaded.
+ */
+#define MP_PENDING_ONE     0x1000000UL
+#define MP_POSITION_MASK   0xFFFFFFUL
+#define MP_RESERVED(state) ((RingBuffer_Index)(state))
+/*
+ * Multi-producer fill limit: under half the index range, so a reserved
+ * index the reader has already passed is told apart from one ahead of it.
+ */
+#define MP_MAX_FILL        ((RingBuffer_Index)((RingBuffer_Index)~0 >> 1))
+
+/*
+ * Reserves up to len bytes past the reserved index and registers the caller
+ * as a pending writer. Returns the reserved length (0 if nothing could be
+ * reserved) and where it starts.
+ */
+static uint16_t reserveMP(RingBuffer *buf, uint16_t len, uint8_t partial, RingBuffer_Index *start) {
+	uint16_t capacity = buf->size < MP_MAX_FILL ? buf->size : MP_MAX_FILL;
+	uint32_t state, next;
+	uint16_t used, freeSpace, granted;
+
+	for(;;) {
+		/* State before tail: the tail read is never older than the reservation it is measured from */
+		state = __atomic_load_n(&buf->mpState, __ATOMIC_ACQUIRE);
+		*start = MP_RESERVED(state);
+		used = (RingBuffer_Index)(*start - RB_LOAD_ACQUIRE(buf->tail));
+		if(used > MP_MAX_FILL)
+			continue;   /* the reader already passed this state: it is stale */
+
+		freeSpace = used < capacity ? capacity - used : 0;
+		granted = len;
+		if(granted > freeSpace) {
+			if(!partial || freeSpace == 0)
+				return 0;
+			granted = freeSpace;
+		}
+		next = ((state & ~MP_POSITION_MASK) + MP_PENDING_ONE) | ((state + granted) & MP_POSITION_MASK);
+		RING_BUFFER_MP_HOOK();
+		if(__atomic_compare_exchange_n(&buf->mpState, &state, next, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return granted;
+	}
+}
+
+/*
+ * Drops the caller from the pending writers. The last one out publishes
+ * everything reserved so far, unless a writer reserved since: that one
+ * publishes instead, and head may already have moved past target, so a
+ * stale target must never be stored.
+ */
+static void commitMP(RingBuffer *buf, uint16_t len) {
+	uint32_t state = __atomic_sub_fetch(&buf->mpState, MP_PENDING_ONE, __ATOMIC_ACQ_REL);
+	RingBuffer_Index target = MP_RESERVED(state);
+	RingBuffer_Index head;
+
+	if(state < MP_PENDING_ONE) {
+		/* head before the recheck: unchanged position means head is still at or behind target */
+		head = RB_LOAD_ACQUIRE(buf->head);
+		RING_BUFFER_MP_HOOK();
+		while(head != target &&
+				((__atomic_load_n(&buf->mpState, __ATOMIC_ACQUIRE) ^ state) & MP_POSITION_MASK) == 0) {
+			if(__atomic_compare_exchange_n(&buf->head, &head, target, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+				break;
+		}
+	}
+
+#if RING_BUFFER_STATS
+	{
+		uint16_t used = (RingBuffer_Index)(target - RB_LOAD_ACQUIRE(buf->tail));
+		uint16_t highWater = __atomic_load_n(&buf->stats.highWater, __ATOMIC_RELAXED);
+
+		/* A reader that raced past target makes used wrap: skip that sample */
+		while(used <= buf->size && used > highWater &&
+				!__atomic_compare_exchange_n(&buf->stats.highWater, &highWater, used, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			;
+		__atomic_fetch_add(&buf->stats.bytesWritten, len, __ATOMIC_RELAXED);
+	}
+#else
+	(void)len;
+#endif
+}
+
+uint8_t RingBuffer_WriteMP(RingBuffer *buf, const uint8_t *data, uint16_t len) {
+	RingBuffer_Index start;
+
+	if(len == 0)
+		return RING_BUFFER_OK;
+	if(reserveMP(buf, len, 0, &start) == 0) {
+		RB_STAT(__atomic_fetch_add(&buf->stats.rejectedWrites, 1, __ATOMIC_RELAXED));
+		return RingBuffer_GetDataLength(buf) >= (buf->size < MP_MAX_FILL ? buf->size : MP_MAX_FILL) ?
+				RING_BUFFER_FULL : RING_BUFFER_NO_SUFFICIENT_SPACE;
+	}
+
+	RING_BUFFER_MP_HOOK();
+	copyIn(buf, start, data, len);
+	commitMP(buf, len);
+	return RING_BUFFER_OK;
+}
+
+uint16_t RingBuffer_WritePartialMP(RingBuffer *buf, const uint8_t *data, uint16_t len) {
+	RingBuffer_Index start;
+	uint16_t granted;
+
+	if(len == 0)
+		return 0;
+	granted = reserveMP(buf, len, 1, &start);
+	if(granted < len)
+		RB_STAT(__atomic_fetch_add(&buf->stats.rejectedWrites, 1, __ATOMIC_RELAXED));
+	if(granted == 0)
+		return 0;
+
+	RING_BUFFER_MP_HOOK();
+	copyIn(buf, start, data, granted);
+	commitMP(buf, granted);
+	return granted;
+}
+
+/* Reader side: copies up to len bytes starting offset bytes past tail */
+uint16_t RingBuffer_Peek(RingBuffer *buf, uint16_t offset, uint8_t *data, uint16_t len) {
+	RingBuffer_Index tail = buf->tail;
+	uint16_t available = (RingBuffer_Index)(RB_LOAD_ACQUIRE(buf->head) - tail);
+
+	if(offset >= available)
+		return 0;
+	if(len > available - offset)
+		len = available - offset;
+
+	copyOut(buf, tail + offset, data, len);
+	return len;
+}
+
+/*
+ * Writer side: places data offset bytes past head without publishing it, so
+ * several pieces can be made visible by a single RingBuffer_Commit. The
+ * caller must have checked that offset + len bytes are free.
+ */
+void RingBuffer_Stage(RingBuffer *buf, uint16_t offset, const uint8_t *data, uint16_t len) {
+	copyIn(buf, buf->head + offset, data, len);
+}
+
+uint16_t RingBuffer_GetReadRegion(RingBuffer *buf, uint8_t **data) {
+	RingBuffer_Index tail = buf->tail;
+	uint16_t available = (RingBuffer_Index)(RB_LOAD_ACQUIRE(buf->head) - tail);
+	uint16_t offset = tail & buf->mask;
+
+	if(available > buf->size - offset)
+		available = buf->size - offset;
+	*data = &buf->buf[offset];
+	return available;
+}
+
+void RingBuffer_Consume(RingBuffer *buf, uint16_t len) {
+	publishTail(buf, buf->tail, len);
+}
+
+uint16_t RingBuffer_GetWriteRegion(RingBuffer *buf, uint8_t **data) {
+	RingBuffer_Index head = buf->head;
+	uint16_t freeSpace = buf->size - (RingBuffer_Index)(head - RB_LOAD_ACQUIRE(buf->tail));
+	uint16_t offset = head & buf->mask;
+
+	if(freeSpace > buf->size - offset)
+		freeSpace = buf->size - offset;
+	*data = &buf->buf[offset];
+	return freeSpace;
+}
+
+void RingBuffer_Commit(RingBuffer *buf, uint16_t len) {
+	publishHead(buf, buf->head, len);
+}
+
+#if RING_BUFFER_STATS
+void RingBuffer_GetStats(RingBuffer *buf, RingBuffer_Stats *stats) {
+	*stats = buf->stats;
+}
+
+void RingBuffer_ResetStats(RingBuffer *buf) {
+	memset(&buf->stats, 0, sizeof(buf->stats));
+}
+#endif
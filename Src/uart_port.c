@@ -0,0 +1,528 @@
+#include "uart_port.h"
+#include <string.h>
+
+#define UART_SR_ERRORS (USART_SR_ORE | USART_SR_FE | USART_SR_NE | USART_SR_PE)
+
+/* Ports the HAL callbacks dispatch to, looked up by handle */
+static UART_Port *ports[UART_PORT_MAX];
+
+static HAL_StatusTypeDef startTxDMA(UART_Port *port, uint8_t *data, uint16_t len);
+static void startRx(UART_Port *port);
+static void rxPump(UART_Port *port);
+static void bridgeReceived(UART_Port *src, uint16_t pos);
+static void bridgeKick(UART_Port *src);
+
+/* Deasserts RTS once rx reaches the stop level; runs after every write to rx */
+static inline void flowCheck(UART_Port *port) {
+	if(port->flow.rtsPort == NULL || port->flow.stopped ||
+			RingBuffer_GetDataLength(&port->rx) < port->flow.stopLevel)
+		return;
+	port->flow.rtsPort->BSRR = port->flow.rtsPin;
+	port->flow.stopped = 1;
+	port->flow.stops++;
+}
+
+/*
+ * Counts the error flags of one SR sample. Whoever then reads DR clears
+ * them, so they must be counted from that same sample: neither a second
+ * SR read nor the HAL will see them again.
+ */
+static inline void countErrors(UART_Port *port, uint32_t sr) {
+	if(!(sr & UART_SR_ERRORS))
+		return;
+	port->errors.overrun += (sr & USART_SR_ORE) != 0;
+	port->errors.framing += (sr & USART_SR_FE) != 0;
+	port->errors.noise += (sr & USART_SR_NE) != 0;
+	port->errors.parity += (sr & USART_SR_PE) != 0;
+}
+
+/* Clears IDLE with the DR read that follows the SR sample it was seen in */
+static inline void clearIdle(UART_Port *port, uint32_t sr) {
+	countErrors(port, sr);
+	(void)port->huart->Instance->DR;
+}
+
+void UART_Port_Init(UART_Port *port, UART_HandleTypeDef *huart, UART_PortMode mode,
+		uint8_t *txStorage, uint16_t txSize, uint8_t *rxStorage, uint16_t rxSize,
+		uint8_t *rxDma, uint16_t rxDmaSize) {
+	RingBuffer tx = port->tx;
+	uint8_t i;
+
+	memset(port, 0, sizeof(*port));
+	port->huart = huart;
+	port->mode = mode;
+	if(huart->hdmatx == NULL || huart->hdmarx == NULL || rxDma == NULL)
+		port->mode = UART_PORT_MODE_IRQ;
+	port->rxDma = rxDma;
+	port->rxDmaSize = rxDmaSize;
+	/* A port kept in .noinit picks up its last output after a warm reset; elsewhere tx is still zero */
+	port->tx = tx;
+	RingBuffer_Resume(&port->tx, txStorage, txSize);
+	RingBuffer_Init(&port->rx, rxStorage, rxSize);
+
+	for(i = 0; i < UART_PORT_MAX; i++) {
+		if(ports[i] == NULL || ports[i]->huart == huart) {
+			ports[i] = port;
+			break;
+		}
+	}
+
+#if UART_ISR_PROFILE
+	/* Free-running cycle counter shared by every port's handler */
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+}
+
+UART_Port *UART_Port_Find(UART_HandleTypeDef *huart) {
+	uint8_t i;
+
+	for(i = 0; i < UART_PORT_MAX && ports[i] != NULL; i++) {
+		if(ports[i]->huart == huart)
+			return ports[i];
+	}
+	return NULL;
+}
+
+void UART_Port_Start(UART_Port *port) {
+	startRx(port);
+}
+
+uint8_t UART_Port_Write(UART_Port *port, const uint8_t *data, uint16_t len) {
+	return UART_Port_WritePolicy(port, data, len, TX_POLICY) == len;
+}
+
+uint16_t UART_Port_WritePolicy(UART_Port *port, const uint8_t *data, uint16_t len, uint8_t policy) {
+	uint32_t tickstart = HAL_GetTick();
+	uint16_t queued = 0;
+
+	if(policy == TX_POLICY_REJECT) {
+		if(RingBuffer_WriteMP(&port->tx, data, len) == RING_BUFFER_OK)
+			queued = len;
+		UART_Port_KickTx(port);
+		return queued;
+	}
+
+	while(1) {
+		queued += RingBuffer_WritePartialMP(&port->tx, data + queued, len - queued);
+		UART_Port_KickTx(port);
+		if(queued == len || policy != TX_POLICY_BLOCK ||
+				(HAL_GetTick() - tickstart) >= TX_BLOCK_TIMEOUT)
+			return queued;
+	}
+}
+
+/*
+ * When nothing else is queued the DMA reads the data in place; otherwise it
+ * is queued behind the pending output like any other message.
+ */
+uint8_t UART_Port_WriteConst(UART_Port *port, const uint8_t *data, uint16_t len) {
+	uint32_t primask;
+
+	if(port->mode == UART_PORT_MODE_DMA) {
+		primask = __get_PRIMASK();
+		__disable_irq();
+		if(!port->txBusy && port->bridge == NULL && RingBuffer_GetDataLength(&port->tx) == 0 &&
+				startTxDMA(port, (uint8_t*)data, len) == HAL_OK) {
+			port->txLen = 0;
+			port->txBusy = 1;
+			__set_PRIMASK(primask);
+			return 1;
+		}
+		__set_PRIMASK(primask);
+	}
+
+	return UART_Port_Write(port, data, len);
+}
+
+uint16_t UART_Port_Read(UART_Port *port, uint8_t *data, uint16_t len) {
+	return RingBuffer_Read(&port->rx, data, len);
+}
+
+/*
+ * Both thread context and the TX complete interrupt call this, so the
+ * check and start run with interrupts masked. While bridged, output stays
+ * queued until the bridge is stopped.
+ */
+void UART_Port_KickTx(UART_Port *port) {
+	uint32_t primask;
+	uint8_t *data;
+	uint16_t len;
+
+	if(port->mode == UART_PORT_MODE_IRQ) {
+		/* The TXE interrupt pulls bytes out of tx and switches itself off when it runs dry */
+		if(RingBuffer_GetDataLength(&port->tx) > 0)
+			SET_BIT(port->huart->Instance->CR1, USART_CR1_TXEIE);
+		return;
+	}
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	if(!port->txBusy && port->bridge == NULL) {
+		len = RingBuffer_GetReadRegion(&port->tx, &data);
+		if(len > 0 && startTxDMA(port, data, len) == HAL_OK) {
+			port->txLen = len;
+			port->txBusy = 1;
+		}
+	}
+	__set_PRIMASK(primask);
+}
+
+uint8_t UART_Port_TxDone(UART_Port *port) {
+	return !port->txBusy && RingBuffer_GetDataLength(&port->tx) == 0 &&
+			(port->huart->Instance->SR & USART_SR_TC);
+}
+
+/* USART1 sits on APB2, every other USART of the F1 on APB1 */
+static uint32_t busClock(UART_Port *port) {
+	return port->huart->Instance == USART1 ? HAL_RCC_GetPCLK2Freq() : HAL_RCC_GetPCLK1Freq();
+}
+
+uint32_t UART_Port_MaxBaud(UART_Port *port) {
+	return busClock(port) / 16;
+}
+
+uint32_t UART_Port_CheckBaud(UART_Port *port, uint32_t baud) {
+	uint32_t pclk = busClock(port);
+
+	/* BRR holds USARTDIV * 16 in 16 bits */
+	if(baud == 0 || baud > pclk / 16 || pclk / baud >= 0xFFFF)
+		return 0;
+	return pclk / UART_BRR_SAMPLING16(pclk, baud);
+}
+
+uint32_t UART_Port_SetBaud(UART_Port *port, uint32_t baud) {
+	USART_TypeDef *usart = port->huart->Instance;
+	uint32_t pclk = busClock(port);
+	uint32_t primask;
+
+	if(UART_Port_CheckBaud(port, baud) == 0)
+		return 0;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	CLEAR_BIT(usart->CR1, USART_CR1_UE);
+	usart->BRR = UART_BRR_SAMPLING16(pclk, baud);
+	SET_BIT(usart->CR1, USART_CR1_UE);
+	port->huart->Init.BaudRate = baud;
+	__set_PRIMASK(primask);
+	return UART_Port_GetBaud(port);
+}
+
+uint32_t UART_Port_GetBaud(UART_Port *port) {
+	return busClock(port) / port->huart->Instance->BRR;
+}
+
+void UART_Port_SetFlowControl(UART_Port *port, GPIO_TypeDef *rtsPort, uint16_t rtsPin, uint16_t threshold) {
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	port->flow.rtsPort = rtsPort;
+	port->flow.rtsPin = rtsPin;
+	port->flow.stopLevel = threshold;
+	port->flow.resumeLevel = threshold / 2;
+	port->flow.stopped = 0;
+	rtsPort->BRR = rtsPin;
+	flowCheck(port);
+	SET_BIT(port->huart->Instance->CR3, USART_CR3_CTSE);
+	port->huart->Init.HwFlowCtl = UART_HWCONTROL_CTS;
+	__set_PRIMASK(primask);
+}
+
+void UART_Port_PollFlow(UART_Port *port) {
+	uint32_t primask;
+
+	if(!port->flow.stopped)
+		return;
+
+	/* The interrupt side may stop again between the check and the write */
+	primask = __get_PRIMASK();
+	__disable_irq();
+	if(port->flow.stopped && RingBuffer_GetDataLength(&port->rx) <= port->flow.resumeLevel) {
+		port->flow.rtsPort->BRR = port->flow.rtsPin;
+		port->flow.stopped = 0;
+	}
+	__set_PRIMASK(primask);
+}
+
+void UART_Port_IRQHandler(UART_Port *port) {
+	USART_TypeDef *usart = port->huart->Instance;
+	uint32_t sr;
+	uint8_t byte;
+#if UART_ISR_PROFILE
+	uint32_t start = DWT->CYCCNT;
+#endif
+
+	sr = usart->SR;
+	if(port->mode == UART_PORT_MODE_IRQ) {
+		/* Reading DR after SR clears RXNE together with any error flag */
+		if(sr & (USART_SR_RXNE | UART_SR_ERRORS)) {
+			byte = (uint8_t)usart->DR;
+			countErrors(port, sr);
+			if(sr & USART_SR_RXNE) {
+				RingBuffer_PutByte(&port->rx, byte);
+				flowCheck(port);
+			}
+		}
+
+		if((sr & USART_SR_TXE) && (usart->CR1 & USART_CR1_TXEIE)) {
+			if(RingBuffer_GetByte(&port->tx, &byte))
+				usart->DR = byte;
+			else
+				CLEAR_BIT(usart->CR1, USART_CR1_TXEIE);
+		}
+	} else {
+		/*
+		 * Line went idle after a burst: publish it without waiting for
+		 * half/full transfer. Errors cleared along with IDLE are counted
+		 * here, so the HAL below only handles the ones raised without it.
+		 */
+		if((sr & USART_SR_IDLE) && __HAL_UART_GET_IT_SOURCE(port->huart, UART_IT_IDLE)) {
+			clearIdle(port, sr);
+			rxPump(port);
+		}
+		HAL_UART_IRQHandler(port->huart);
+	}
+
+#if UART_ISR_PROFILE
+	{
+		uint32_t cycles = DWT->CYCCNT - start;
+
+		port->isrCycles.last = cycles;
+		if(cycles > port->isrCycles.max)
+			port->isrCycles.max = cycles;
+		port->isrCycles.total += cycles;
+		port->isrCycles.count++;
+	}
+#endif
+}
+
+/*
+ * Only the transfer complete event is needed to re-arm, so the half
+ * transfer interrupt the HAL enables is switched off again.
+ */
+static HAL_StatusTypeDef startTxDMA(UART_Port *port, uint8_t *data, uint16_t len) {
+	HAL_StatusTypeDef status = HAL_UART_Transmit_DMA(port->huart, data, len);
+
+	if(status == HAL_OK)
+		__HAL_DMA_DISABLE_IT(port->huart->hdmatx, DMA_IT_HT);
+	return status;
+}
+
+/*
+ * IRQ mode: every received byte raises RXNE. DMA mode: circular reception
+ * into rxDma stays armed for good, and the half transfer, transfer complete
+ * and IDLE line events publish whatever arrived into rx.
+ */
+static void startRx(UART_Port *port) {
+	uint32_t reported;
+
+	if(port->mode == UART_PORT_MODE_IRQ) {
+		SET_BIT(port->huart->Instance->CR1, USART_CR1_RXNEIE);
+		return;
+	}
+
+	/* Error flags still set after HAL_UART_ErrorCallback have been counted there already */
+	reported = ((port->huart->ErrorCode & HAL_UART_ERROR_ORE) ? USART_SR_ORE : 0) |
+			((port->huart->ErrorCode & HAL_UART_ERROR_FE) ? USART_SR_FE : 0) |
+			((port->huart->ErrorCode & HAL_UART_ERROR_NE) ? USART_SR_NE : 0) |
+			((port->huart->ErrorCode & HAL_UART_ERROR_PE) ? USART_SR_PE : 0);
+
+	/* Restarting rewinds the DMA to the start of rxDma, so unsent bridge data is lost */
+	port->bridgeStats.dropped += port->bridgePending;
+	port->bridgePending = 0;
+	port->rxDmaPos = 0;
+	if(HAL_UART_Receive_DMA(port->huart, port->rxDma, port->rxDmaSize) != HAL_OK)
+		return;
+
+	clearIdle(port, port->huart->Instance->SR & ~reported);
+	__HAL_UART_ENABLE_IT(port->huart, UART_IT_IDLE);
+}
+
+/* Copies the bytes the DMA wrote since the last call from rxDma into rx */
+static void rxPump(UART_Port *port) {
+	uint16_t pos = port->rxDmaSize - __HAL_DMA_GET_COUNTER(port->huart->hdmarx);
+
+	if(pos == port->rxDmaPos)
+		return;
+
+	if(port->bridge != NULL) {
+		bridgeReceived(port, pos);
+		return;
+	}
+
+	if(pos > port->rxDmaPos) {
+		RingBuffer_WritePartial(&port->rx, &port->rxDma[port->rxDmaPos], pos - port->rxDmaPos);
+	} else {
+		RingBuffer_WritePartial(&port->rx, &port->rxDma[port->rxDmaPos], port->rxDmaSize - port->rxDmaPos);
+		RingBuffer_WritePartial(&port->rx, port->rxDma, pos);
+	}
+	port->rxDmaPos = pos == port->rxDmaSize ? 0 : pos;
+	flowCheck(port);
+}
+
+HAL_StatusTypeDef UART_Port_BridgeStart(UART_Port *a, UART_Port *b) {
+	uint32_t tickstart = HAL_GetTick();
+	uint32_t primask;
+
+	if(a->mode != UART_PORT_MODE_DMA || b->mode != UART_PORT_MODE_DMA)
+		return HAL_ERROR;
+
+	/* The bridge takes over both TX DMA channels: let queued output finish first */
+	while(1) {
+		primask = __get_PRIMASK();
+		__disable_irq();
+		if(!a->txBusy && !b->txBusy &&
+				RingBuffer_GetDataLength(&a->tx) == 0 && RingBuffer_GetDataLength(&b->tx) == 0)
+			break;
+		__set_PRIMASK(primask);
+		if((HAL_GetTick() - tickstart) >= TX_BLOCK_TIMEOUT)
+			return HAL_TIMEOUT;
+	}
+
+	/* What already arrived goes to the RX rings; the bridge starts at the current DMA position */
+	rxPump(a);
+	rxPump(b);
+	a->bridgePending = a->bridgeInFlight = 0;
+	b->bridgePending = b->bridgeInFlight = 0;
+	memset(&a->bridgeStats, 0, sizeof(a->bridgeStats));
+	memset(&b->bridgeStats, 0, sizeof(b->bridgeStats));
+	a->bridge = b;
+	b->bridge = a;
+	__set_PRIMASK(primask);
+	return HAL_OK;
+}
+
+void UART_Port_BridgeStop(UART_Port *a, UART_Port *b) {
+	uint32_t primask = __get_PRIMASK();
+
+	/* A transfer still in flight completes through the normal path, which consumes nothing */
+	__disable_irq();
+	a->bridge = NULL;
+	b->bridge = NULL;
+	__set_PRIMASK(primask);
+
+	UART_Port_KickTx(a);
+	UART_Port_KickTx(b);
+}
+
+/*
+ * Accounts for the bytes the RX DMA wrote up to pos. The oldest bytes are
+ * the in-flight run the peer's TX DMA is reading, so a DMA that laps the
+ * buffer overwrites those first: the peer is stopped before it sends them,
+ * and what it had not sent yet goes back to pending, oldest first. If the
+ * peer falls a whole buffer behind, the oldest unsent bytes are lost.
+ */
+static void bridgeReceived(UART_Port *src, uint16_t pos) {
+	UART_Port *dst = src->bridge;
+	uint32_t pending = src->bridgePending;
+	uint16_t unsent = src->bridgeInFlight ? __HAL_DMA_GET_COUNTER(dst->huart->hdmatx) : 0;
+	uint16_t room;
+
+	pending += pos > src->rxDmaPos ? pos - src->rxDmaPos : src->rxDmaSize - src->rxDmaPos + pos;
+	src->bridgeStats.rxBytes += pending - src->bridgePending;
+
+	/* Lapped: the write position passed the start of the unsent part of the run */
+	if(unsent != 0 && pending > (uint32_t)(src->rxDmaSize - unsent)) {
+		HAL_UART_AbortTransmit(dst->huart);
+		unsent = __HAL_DMA_GET_COUNTER(dst->huart->hdmatx);
+		src->bridgeStats.txBytes += src->bridgeInFlight - unsent;
+		src->bridgeInFlight = 0;
+		pending += unsent;
+		unsent = 0;
+		dst->txBusy = 0;
+	}
+
+	room = src->rxDmaSize - unsent;
+	if(pending > room) {
+		src->bridgeStats.dropped += pending - room;
+		pending = room;
+	}
+	src->bridgePending = pending;
+	src->rxDmaPos = pos == src->rxDmaSize ? 0 : pos;
+	bridgeKick(src);
+}
+
+/* Points the peer's TX DMA at the oldest unsent contiguous run of src->rxDma */
+static void bridgeKick(UART_Port *src) {
+	UART_Port *dst = src->bridge;
+	uint16_t start, len;
+
+	if(dst->txBusy || src->bridgePending == 0)
+		return;
+
+	start = (src->rxDmaPos + src->rxDmaSize - src->bridgePending) % src->rxDmaSize;
+	len = src->rxDmaSize - start;
+	if(len > src->bridgePending)
+		len = src->bridgePending;
+	if(startTxDMA(dst, &src->rxDma[start], len) != HAL_OK)
+		return;
+
+	dst->txLen = 0;
+	dst->txBusy = 1;
+	src->bridgeInFlight = len;
+	src->bridgePending -= len;
+}
+
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart) {
+	UART_Port *port = UART_Port_Find(huart);
+
+	if(port != NULL)
+		rxPump(port);
+}
+
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart) {
+	UART_Port *port = UART_Port_Find(huart);
+
+	/* Circular mode: the DMA has already wrapped and keeps running */
+	if(port != NULL)
+		rxPump(port);
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
+	UART_Port *port = UART_Port_Find(huart);
+
+	if(port == NULL)
+		return;
+
+	if(port->bridge != NULL) {
+		/* port sent a run of its peer's rxDma: hand it the next one */
+		port->bridge->bridgeStats.txBytes += port->bridge->bridgeInFlight;
+		port->bridge->bridgeInFlight = 0;
+		port->txLen = 0;
+		port->txBusy = 0;
+		bridgeKick(port->bridge);
+		return;
+	}
+
+	/* Release what the last transfer sent straight out of tx (nothing for a constant), then send the next region in place */
+	RingBuffer_Consume(&port->tx, port->txLen);
+	port->txLen = 0;
+	port->txBusy = 0;
+	UART_Port_KickTx(port);
+}
+
+/*
+ * Errors abort DMA reception (the HAL treats them as blocking in DMA mode):
+ * keep what already arrived and re-arm straight away.
+ */
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart) {
+	UART_Port *port = UART_Port_Find(huart);
+
+	if(port == NULL)
+		return;
+
+	if(huart->ErrorCode & HAL_UART_ERROR_ORE)
+		port->errors.overrun++;
+	if(huart->ErrorCode & HAL_UART_ERROR_FE)
+		port->errors.framing++;
+	if(huart->ErrorCode & HAL_UART_ERROR_NE)
+		port->errors.noise++;
+	if(huart->ErrorCode & HAL_UART_ERROR_PE)
+		port->errors.parity++;
+
+	if(huart->RxState == HAL_UART_STATE_READY) {
+		rxPump(port);
+		startRx(port);
+	}
+}
@@ -22,20 +22,102 @@
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
-
+#include <errno.h>
+#include <unistd.h>
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
 /* USER CODE BEGIN PTD */
-
+/* Negotiated rate of one port */
+typedef struct {
+  UART_Port *port;
+  const char *name;
+  uint32_t bootBaud;    /* MX_USARTx_UART_Init's rate, the last resort */
+  uint32_t goodBaud;    /* last rate that worked, the fallback while on probation */
+  uint32_t errorMark;   /* receive error total at the last check */
+  uint32_t switchTick;
+  uint8_t probation;    /* running at a rate not confirmed yet */
+  uint32_t pendingBaud; /* switch waiting for queued output to drain, 0 for none */
+  uint32_t pendingTick;
+  uint8_t pendingProbation; /* 0: the pending switch is a fallback */
+  uint8_t pendingPrompt;    /* a console command waits for its prompt */
+} BaudLink;
 /* USER CODE END PTD */
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
 
+#define CLEAR_SCREEN "\033[0;0H\033[2J"
 #define WELCOME_MSG "Welcome to the Nucleo management console\r\n"
-#define MAIN_MENU   "Select the option you are interested in:\r\n\t1. Toggle LD2 LED\r\n\t2. Read USER BUTTON status\r\n\t3. Clear screen and print this message "
 #define PROMPT "\r\n> "
+
+/*
+ * Console command registry: X(number, name, handler, help). A command is
+ * selected by its number or its name; numbers must run 1, 2, 3... in
+ * order, which is checked at compile time. The menu below and the flash
+ * lookup table are both generated from this list.
+ */
+#define CONSOLE_COMMANDS(X) \
+  X(1, "led",       cmdLed,         "Toggle LD2 LED") \
+  X(2, "button",    cmdButton,      "Read USER BUTTON status") \
+  X(3, "menu",      cmdMenu,        "Clear screen and print this message") \
+  X(4, "bufstats",  cmdBufferStats, "Show TX/RX buffer statistics") \
+  X(5, "uartstats", cmdUartStats,   "Show USART1/USART2 error and interrupt statistics") \
+  X(6, "bridge",    cmdBridge,      "Bridge USART1 <-> USART2, USER BUTTON stops") \
+  X(7, "fwcrc",     cmdFirmwareCrc, "CRC32 of the firmware image") \
+  X(8, "baud",      cmdBaud,        "Show baud rates, or set one: baud <1|2> <rate>")
+
+#define MENU_ITEM(num, name, handler, help) "\r\n\t" #num ". " help " (" name ")"
+#define MAIN_MENU   "Select the option you are interested in:" CONSOLE_COMMANDS(MENU_ITEM) " "
+
+/* Ring buffer capacities, each a power of two */
+#define TX_BUFFER_SIZE 1024
+#define RX_BUFFER_SIZE 128
+#define RX_DMA_SIZE    64
+
+/* USART1 carries bulk data, so it gets deeper queues than the console */
+#define UART1_TX_BUFFER_SIZE 1024
+#define UART1_RX_BUFFER_SIZE 1024
+#define UART1_RX_DMA_SIZE    256
+
+/*
+ * RX ring fill that drops RTS when flow control is on. What lies above it
+ * covers half an RX DMA buffer plus the bytes a USB serial adapter still
+ * sends after RTS drops.
+ */
+#define RX_RTS_THRESHOLD       (RX_BUFFER_SIZE / 2)
+#define UART1_RX_RTS_THRESHOLD (UART1_RX_BUFFER_SIZE / 2)
+
+/* What printf does when the console TX ring is full: never stall the caller by default */
+#ifndef STDOUT_POLICY
+#define STDOUT_POLICY TX_POLICY_PARTIAL
+#endif
+
+/* Stack buffer each console line is formatted into */
+#define CONSOLE_LINE_SIZE 96
+
+/* Longest input line, most words per line and input bytes parsed per main loop pass */
+#define CONSOLE_CMD_SIZE    64
+#define CONSOLE_MAX_ARGS    8
+#define CONSOLE_POLL_BUDGET 32
+
+#define CRITICAL_TASK_PERIOD 100
+
+/* ms a binary frame may take to arrive before the console takes over again */
+#define FRAME_TIMEOUT 100
+
+/*
+ * A new baud rate must be confirmed within BAUD_PROBATION ms; more than
+ * BAUD_ERROR_LIMIT receive errors in one BAUD_CHECK_PERIOD fall back.
+ */
+#define BAUD_PROBATION    1000
+#define BAUD_CHECK_PERIOD 100
+#define BAUD_ERROR_LIMIT  8
+/* ms a switch may wait for the output queued at the old rate to go out */
+#define BAUD_DRAIN_TIMEOUT 500
+
+/* Firmware CRC attempts after a DMA transfer error before giving up */
+#define FW_CRC_RETRIES 3
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -50,19 +132,58 @@ RTC_HandleTypeDef hrtc;
 
 UART_HandleTypeDef huart1;
 UART_HandleTypeDef huart2;
+DMA_HandleTypeDef hdma_usart1_rx;
+DMA_HandleTypeDef hdma_usart1_tx;
+DMA_HandleTypeDef hdma_usart2_rx;
+DMA_HandleTypeDef hdma_usart2_tx;
 
 PCD_HandleTypeDef hpcd_USB_FS;
 
-char readBuf[10];
-uint8_t txData;
-__IO ITStatus UartReady = SET;
-RingBuffer txBuf, rxBuf;
+/*
+ * USART2 is the console, USART1 a second data channel. The console port and
+ * its TX storage are kept over warm resets: the last console output can be
+ * read back post-mortem, ending at uart2Port.tx.head.
+ */
+UART_Port uart1Port;
+UART_Port uart2Port RING_BUFFER_NOINIT;
+RING_BUFFER_STORAGE_NOINIT(txStorage, TX_BUFFER_SIZE);
+RING_BUFFER_STORAGE(rxStorage, RX_BUFFER_SIZE);
+static uint8_t rxDmaBuf[RX_DMA_SIZE];
+RING_BUFFER_STORAGE(uart1TxStorage, UART1_TX_BUFFER_SIZE);
+RING_BUFFER_STORAGE(uart1RxStorage, UART1_RX_BUFFER_SIZE);
+static uint8_t uart1RxDmaBuf[UART1_RX_DMA_SIZE];
+
+LineReader consoleReader;
+static char cmdLine[CONSOLE_CMD_SIZE];
+/* Binary frames share USART2 with the console; a leading NUL selects them */
+FrameReader frameReader;
+static uint8_t frameBuf[COBS_MAX_ENCODED(FRAME_MAX_RAW)];
+uint8_t frameMode;
+uint32_t frameStartTick;
+
+uint8_t bridgeActive;
+uint32_t bridgeStartTick;
+
+/* Indexed by port number - 1 */
+BaudLink baudLinks[2];
+
+/* Firmware image check, completed from the CRC DMA interrupt */
+volatile uint8_t fwCrcReady;
+volatile uint8_t fwCrcOk;
+volatile uint32_t fwCrc;
+volatile uint32_t fwCrcCycles;
+uint32_t fwCrcStartCycles;
+uint8_t fwCrcRetries;
+
+/* The whole start screen as one flash blob, sent with a single transfer */
+static const char welcomeScreen[] = CLEAR_SCREEN WELCOME_MSG MAIN_MENU PROMPT;
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
 /* USER CODE BEGIN PFP */
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
+static void MX_DMA_Init(void);
 static void MX_RTC_Init(void);
 static void MX_USB_PCD_Init(void);
 static void MX_USART1_UART_Init(void);
@@ -71,13 +192,45 @@ static void MX_USART2_UART_Init(void);
 //extern void MX_USART2_UART_Init(void);
 void performCriticalTasks(void);
 void printWelcomeMessage(void);
-uint8_t processUserInput(int8_t opt);
-void clearRxBuffer(void);
-char* readUserInput(void);
+static void consoleEcho(const char *data, uint16_t len);
+static void consoleReply(const char *msg);
+static uint8_t dispatchCommand(uint8_t argc, char **argv);
+static uint8_t pollConsole(void);
+static void handleFrame(uint16_t len);
+static void sendFrame(const Frame *f);
+static void sendNack(uint8_t id, uint8_t reason);
+static uint16_t packPortStats(uint8_t *payload, uint8_t number, UART_Port *port);
+void printBufferStats(void);
+void printUartStats(void);
+#define CMD_PROTOTYPE(num, name, handler, help) static uint8_t handler(uint8_t argc, char **argv);
+CONSOLE_COMMANDS(CMD_PROTOTYPE)
+static void printPortStats(const char *name, UART_Port *port);
+void startBridge(void);
+void serviceBridge(void);
+static void printBridgeStats(uint32_t elapsed);
+static uint8_t startFirmwareCrc(void);
+static void fwCrcDone(uint32_t crc, uint8_t ok);
+void serviceFirmwareCrc(void);
+static uint32_t portErrors(UART_Port *port);
+static void switchBaud(BaudLink *link, uint32_t baud, uint8_t prompt);
+static void applyBaud(BaudLink *link);
+static void confirmBaud(BaudLink *link);
+void serviceBaud(void);
+int _write(int file, char *ptr, int len);
+static void consoleSend(Fmt *f);
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
+#define CMD_INDEX(num, name, handler, help) CMD_INDEX_##handler,
+enum { CONSOLE_COMMANDS(CMD_INDEX) CMD_COUNT };
+#define CMD_CHECK(num, name, handler, help) \
+  _Static_assert(num == CMD_INDEX_##handler + 1, "command " name " is out of order"); \
+  _Static_assert(sizeof(name) - 1 <= CMD_NAME_MAX, "command name " name " is too long");
+CONSOLE_COMMANDS(CMD_CHECK)
+
+#define CMD_ENTRY(num, name, handler, help) { name, CMD_HASH(name), handler, help },
+static const Cmd commands[CMD_COUNT] = { CONSOLE_COMMANDS(CMD_ENTRY) };
 
 /* USER CODE END 0 */
 
@@ -88,8 +241,6 @@ char* readUserInput(void);
 int main(void)
 {
   /* USER CODE BEGIN 1 */
-  char* opt;
-  //uint8_t opt = 0;
 
   /* USER CODE END 1 */
 
@@ -107,138 +258,635 @@ int main(void)
   /* USER CODE END SysInit */
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
+  MX_DMA_Init();
   MX_RTC_Init();
   MX_USB_PCD_Init();
   MX_USART1_UART_Init();
   MX_USART2_UART_Init();
   /* USER CODE BEGIN 2 */
-
+  UART_Port_Init(&uart2Port, &huart2, USART2_FAST_IRQ ? UART_PORT_MODE_IRQ : UART_PORT_MODE_DMA,
+      txStorage, sizeof(txStorage), rxStorage, sizeof(rxStorage), rxDmaBuf, sizeof(rxDmaBuf));
+  UART_Port_Init(&uart1Port, &huart1, UART_PORT_MODE_DMA,
+      uart1TxStorage, sizeof(uart1TxStorage), uart1RxStorage, sizeof(uart1RxStorage),
+      uart1RxDmaBuf, sizeof(uart1RxDmaBuf));
+#if USART1_FLOW_CONTROL
+  /* PA11/PA12 carry CTS/RTS instead of USB D-/D+ */
+  HAL_PCD_DeInit(&hpcd_USB_FS);
+  UART_Port_SetFlowControl(&uart1Port, GPIOA, GPIO_PIN_12, UART1_RX_RTS_THRESHOLD);
+#endif
+#if USART2_FLOW_CONTROL
+  UART_Port_SetFlowControl(&uart2Port, GPIOA, GPIO_PIN_1, RX_RTS_THRESHOLD);
+#endif
+  Crc32_Init();
+  /* fwcrc times the image CRC on the cycle counter, with or without UART_ISR_PROFILE */
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  baudLinks[0] = (BaudLink){ &uart1Port, "USART1", huart1.Init.BaudRate, huart1.Init.BaudRate };
+  baudLinks[1] = (BaudLink){ &uart2Port, "USART2", huart2.Init.BaudRate, huart2.Init.BaudRate };
   /* USER CODE END 2 */
 
-  /* Enable USART2 interrupt */
+  /* Enable USART1 and USART2 interrupts */
+  HAL_NVIC_SetPriority(USART1_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(USART1_IRQn);
   HAL_NVIC_SetPriority(USART2_IRQn, 0, 0);
   HAL_NVIC_EnableIRQ(USART2_IRQn);
 
+  UART_Port_Start(&uart1Port);
+  UART_Port_Start(&uart2Port);
+  /* Unbuffered: every printf reaches _write as one span, without waiting for a newline */
+  setvbuf(stdout, NULL, _IONBF, 0);
+  LineReader_Init(&consoleReader, cmdLine, sizeof(cmdLine), consoleEcho);
+  FrameReader_Init(&frameReader, frameBuf, sizeof(frameBuf));
+
 printMessage:
 
   printWelcomeMessage();
 
   while (1)  {
-    //char ms[30];
-    opt = readUserInput();
-    //sprintf(ms, "%d", opt);
-    //HAL_UART_Transmit(&huart2, (uint8_t*)ms, strlen(ms), HAL_MAX_DELAY);
-    //HAL_UART_Transmit(&huart2, (uint8_t*)opt , strlen(readBuf), HAL_MAX_DELAY);
-    //HAL_UART_Transmit(&huart2, (uint8_t*)"\r\n", 2, HAL_MAX_DELAY);
-    /*
-    if(opt > 0) {
-      processUserInput(opt);
-      if(opt == 3)
-        goto printMessage;
-    }
-    */
-    //processUserInput(opt);
+    if(pollConsole() == 2)
+      goto printMessage;
+    UART_Port_PollFlow(&uart1Port);
+    UART_Port_PollFlow(&uart2Port);
+    serviceBridge();
+    serviceFirmwareCrc();
+    serviceBaud();
     performCriticalTasks();
-    HAL_UART_ErrorCallback(&huart2);
   }
 }
 
-uint8_t UART_Transmit(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t len) {
-  if(HAL_UART_Transmit_IT(huart, pData, len) != HAL_OK) {
-    if(RingBuffer_Write(&txBuf, pData, len) != RING_BUFFER_OK)
-      return 0;
+/*
+ * Feeds console input to the line reader, or to the frame reader once a
+ * NUL has opened a binary frame. Each pass parses at most
+ * CONSOLE_POLL_BUDGET bytes, so a command waits one short pass at most.
+ * Returns 2 when the start screen should be redrawn.
+ */
+static uint8_t pollConsole(void) {
+  char *argv[CONSOLE_MAX_ARGS];
+  uint8_t argc;
+  int16_t len;
+  uint8_t b;
+
+  if(frameMode) {
+    len = FrameReader_Poll(&frameReader, &uart2Port.rx, CONSOLE_POLL_BUDGET);
+    if(len > 0)
+      handleFrame((uint16_t)len);
+    if(len != FRAME_READER_NONE) {
+      frameMode = 0;
+    } else if((HAL_GetTick() - frameStartTick) >= FRAME_TIMEOUT) {
+      /* A stray NUL: give the console back */
+      FrameReader_Init(&frameReader, frameBuf, sizeof(frameBuf));
+      frameMode = 0;
+    }
+    return 0;
   }
-  return 1;
+
+  if(consoleReader.len == 0 && RingBuffer_Peek(&uart2Port.rx, 0, &b, 1) == 1 && b == FRAME_DELIMITER) {
+    RingBuffer_Consume(&uart2Port.rx, 1);
+    frameMode = 1;
+    frameStartTick = HAL_GetTick();
+    return 0;
+  }
+
+  len = LineReader_Poll(&consoleReader, &uart2Port.rx, CONSOLE_POLL_BUDGET);
+  if(len >= 0) {
+    argc = LineReader_Tokenize(cmdLine, argv, CONSOLE_MAX_ARGS);
+    return dispatchCommand(argc, argv);
+  }
+  if(len == LINE_READER_TOO_LONG)
+    consoleReply("Line too long");
+  return 0;
 }
 
-void clearRxBuffer()
-{
-	int n;
-	int nMax = sizeof(readBuf)-1;
-	for(n=0;n<nMax;n++)
-	{
-		readBuf[n] = '\0';
-	}
-}
-
- char* readUserInput() {
-  //int8_t retVal = -1;
-  char *retVal;
-
-  if(UartReady == SET) {
-    UartReady = RESET;
-    HAL_UART_Receive_IT(&huart2, (uint8_t*)readBuf, sizeof(readBuf));
-    //retVal = atoi(readBuf);
-    retVal = &readBuf[0];
-    //HAL_UART_Transmit(&huart2, (uint8_t*)retVal , strlen(readBuf), HAL_MAX_DELAY);
-    UART_Transmit(&huart2, (uint8_t*)retVal, strlen(readBuf));
-    //clearRxBuffer();
+/* Answers one received frame. Undecodable frames are dropped; a bad CRC gets a NACK with id 0 */
+static void handleFrame(uint16_t len) {
+  uint8_t payload[FRAME_STATS_SIZE];
+  Frame req, rep;
+  BaudLink *link;
+  uint32_t baud, actual;
+  uint8_t status = Frame_Decode(frameBuf, len, &req);
+
+  if(status == FRAME_BAD_CRC)
+    sendNack(0, FRAME_ERR_CRC);
+  if(status != FRAME_OK)
+    return;
+  /* Anything intact proves the console rate works */
+  confirmBaud(&baudLinks[1]);
+
+  rep.type = req.type | FRAME_REPLY;
+  rep.id = req.id;
+  rep.payload = payload;
+  rep.len = 0;
+  switch(req.type) {
+  case FRAME_PING:
+    /* The request payload is still in frameBuf */
+    rep.payload = req.payload;
+    rep.len = req.len;
+    break;
+  case FRAME_GET_STATS:
+    if(req.len != 1 || (req.payload[0] != 1 && req.payload[0] != 2)) {
+      sendNack(req.id, FRAME_ERR_PAYLOAD);
+      return;
+    }
+    rep.len = packPortStats(payload, req.payload[0], req.payload[0] == 1 ? &uart1Port : &uart2Port);
+    break;
+  case FRAME_SET_BAUD:
+    if(req.len != 5 || (req.payload[0] != 1 && req.payload[0] != 2)) {
+      sendNack(req.id, FRAME_ERR_PAYLOAD);
+      return;
+    }
+    link = &baudLinks[req.payload[0] - 1];
+    baud = Frame_GetU32(&req.payload[1]);
+    actual = UART_Port_CheckBaud(link->port, baud);
+    if(actual == 0) {
+      sendNack(req.id, FRAME_ERR_PAYLOAD);
+      return;
+    }
+    payload[0] = req.payload[0];
+    Frame_PutU32(&payload[1], actual);
+    rep.len = 5;
+    sendFrame(&rep);
+    switchBaud(link, baud, 0);
+    return;
+  default:
+    sendNack(req.id, FRAME_ERR_TYPE);
+    return;
   }
-  return retVal;
+  sendFrame(&rep);
 }
 
-void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
-{
-  if(huart->ErrorCode == HAL_UART_ERROR_ORE)
-  {
-    HAL_UART_Receive_IT(&huart2, (uint8_t*)readBuf, sizeof(readBuf));
+static void sendFrame(const Frame *f) {
+  uint8_t out[FRAME_MAX_ENCODED];
+
+  UART_Port_Write(&uart2Port, out, Frame_Encode(f, out));
+}
+
+static void sendNack(uint8_t id, uint8_t reason) {
+  Frame f = { FRAME_NACK, id, &reason, 1 };
+
+  sendFrame(&f);
+}
+
+/* Fills a FRAME_GET_STATS reply payload; returns its length */
+static uint16_t packPortStats(uint8_t *payload, uint8_t number, UART_Port *port) {
+  uint8_t *p = payload;
+  RingBuffer_Stats ring[2];
+  uint8_t i;
+
+  memset(ring, 0, sizeof(ring));
+#if RING_BUFFER_STATS
+  RingBuffer_GetStats(&port->tx, &ring[0]);
+  RingBuffer_GetStats(&port->rx, &ring[1]);
+#endif
+
+  *p++ = number;
+  *p++ = (uint8_t)port->mode;
+  p = Frame_PutU32(p, port->errors.overrun);
+  p = Frame_PutU32(p, port->errors.framing);
+  p = Frame_PutU32(p, port->errors.noise);
+  p = Frame_PutU32(p, port->errors.parity);
+  for(i = 0; i < 2; i++) {
+    p = Frame_PutU16(p, ring[i].highWater);
+    p = Frame_PutU32(p, ring[i].bytesWritten);
+    p = Frame_PutU32(p, ring[i].bytesRead);
+    p = Frame_PutU32(p, ring[i].rejectedWrites);
+    p = Frame_PutU32(p, ring[i].overflows);
   }
+  p = Frame_PutU32(p, port->isrCycles.last);
+  p = Frame_PutU32(p, port->isrCycles.max);
+  p = Frame_PutU32(p, port->isrCycles.total);
+  p = Frame_PutU32(p, port->isrCycles.count);
+  return (uint16_t)(p - payload);
 }
 
+static void consoleEcho(const char *data, uint16_t len) {
+  UART_Port_Write(&uart2Port, (const uint8_t*)data, len);
+}
 
-uint8_t processUserInput(int8_t opt) {
-  char msg[30];
+static void consoleReply(const char *msg) {
+  char line[CONSOLE_LINE_SIZE];
+  Fmt f;
 
-  if(!(opt >=1 && opt <= 35))
+  Fmt_Init(&f, line, sizeof(line));
+  Fmt_Print(&f, msg, PROMPT);
+  consoleSend(&f);
+}
+
+/* Runs one tokenized console line; the first word selects the command */
+static uint8_t dispatchCommand(uint8_t argc, char **argv) {
+  const Cmd *cmd;
+  uint8_t result;
+
+  if(argc == 0) {
+    consoleReply("");
+    return 1;
+  }
+
+  cmd = Cmd_Find(commands, CMD_COUNT, argv[0]);
+  if(cmd == NULL) {
+    consoleReply("Unknown command");
     return 0;
+  }
 
-  sprintf(msg, "%d", opt);
-  //HAL_UART_Transmit(&huart2, (uint8_t*)msg, strlen(msg), HAL_MAX_DELAY);
-  UART_Transmit(&huart2, (uint8_t*)msg, strlen(msg));
+  confirmBaud(&baudLinks[1]);
+  result = cmd->handler(argc, argv);
+  if(result == 1)
+    consoleReply("");
+  return result;
+}
 
-  switch(opt) {
-  case 1:
-    HAL_GPIO_TogglePin(GPIOB, GPIO_PIN_9);
-    break;
-  case 2:
-    sprintf(msg, "\r\nUSER BUTTON status: %s",
-        HAL_GPIO_ReadPin(GPIOB, GPIO_PIN_7) == GPIO_PIN_RESET ? "PRESSED" : "RELEASED");
-    //HAL_UART_Transmit(&huart2, (uint8_t*)msg, strlen(msg), HAL_MAX_DELAY);
-    UART_Transmit(&huart2, (uint8_t*)msg, strlen(msg));
-    break;
-  case 3:
-    return 2;
-  };
+static uint8_t cmdLed(uint8_t argc, char **argv) {
+  HAL_GPIO_TogglePin(GPIOB, GPIO_PIN_9);
+  return 1;
+}
+
+static uint8_t cmdButton(uint8_t argc, char **argv) {
+  char line[CONSOLE_LINE_SIZE];
+  Fmt f;
+
+  Fmt_Init(&f, line, sizeof(line));
+  Fmt_Print(&f, "USER BUTTON status: ",
+      HAL_GPIO_ReadPin(GPIOB, GPIO_PIN_7) == GPIO_PIN_RESET ? "PRESSED" : "RELEASED");
+  consoleSend(&f);
+  return 1;
+}
+
+static uint8_t cmdMenu(uint8_t argc, char **argv) {
+  return 2;
+}
+
+static uint8_t cmdBufferStats(uint8_t argc, char **argv) {
+  printBufferStats();
+  return 1;
+}
 
-  //HAL_UART_Transmit(&huart2, (uint8_t*)PROMPT, strlen(PROMPT), HAL_MAX_DELAY);.
-  UART_Transmit(&huart2, (uint8_t*)PROMPT, strlen(PROMPT));
+static uint8_t cmdUartStats(uint8_t argc, char **argv) {
+  printUartStats();
   return 1;
 }
 
-void HAL_UART_RxCpltCallback(UART_HandleTypeDef *UartHandle) {
- /* Set transmission flag: transfer complete*/
- UartReady = SET;
+static uint8_t cmdBridge(uint8_t argc, char **argv) {
+  startBridge();
+  return 1;
 }
 
-void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
-  if(RingBuffer_GetDataLength(&txBuf) > 0) {
-    RingBuffer_Read(&txBuf, &txData, 1);
-    HAL_UART_Transmit_IT(huart, &txData, 1);
+static uint8_t cmdBaud(uint8_t argc, char **argv) {
+  char line[CONSOLE_LINE_SIZE];
+  Fmt f;
+  BaudLink *link;
+  uint32_t baud, actual;
+  uint8_t i;
+
+  if(argc == 1) {
+    for(i = 0; i < 2; i++) {
+      link = &baudLinks[i];
+      Fmt_Init(&f, line, sizeof(line));
+      Fmt_Print(&f, "\r\n", link->name, ": ", UART_Port_GetBaud(link->port), " baud (max ",
+          UART_Port_MaxBaud(link->port), link->probation ? ", on probation)" : ")");
+      consoleSend(&f);
+    }
+    return 1;
   }
+
+  if(argc != 3 || (strcmp(argv[1], "1") != 0 && strcmp(argv[1], "2") != 0)) {
+    consoleReply("Usage: baud <1|2> <rate>");
+    return 0;
+  }
+  link = &baudLinks[argv[1][0] - '1'];
+  baud = strtoul(argv[2], NULL, 10);
+  actual = UART_Port_CheckBaud(link->port, baud);
+  Fmt_Init(&f, line, sizeof(line));
+  if(actual == 0) {
+    Fmt_Print(&f, "\r\nUnsupported rate, ", link->name, " runs up to ", UART_Port_MaxBaud(link->port));
+    consoleSend(&f);
+    return 1;
+  }
+  /* On USART2 the prompt comes at the new rate; it has to be answered within BAUD_PROBATION */
+  Fmt_Print(&f, "\r\n", link->name, " switching to ", actual, " baud");
+  consoleSend(&f);
+  switchBaud(link, baud, 1);
+  return 0;
+}
+
+static uint8_t cmdFirmwareCrc(uint8_t argc, char **argv) {
+  fwCrcRetries = FW_CRC_RETRIES;
+  /* On success serviceFirmwareCrc prints the result and the prompt */
+  if(!startFirmwareCrc())
+    consoleReply("CRC unit busy");
+  return 0;
+}
+
+/* The image is everything from the vector table to the end of the .data load copy */
+static uint8_t startFirmwareCrc(void) {
+  extern uint32_t _sidata, _sdata, _edata;
+  uint32_t len = (uint32_t)&_sidata + ((uint32_t)&_edata - (uint32_t)&_sdata) - FLASH_BASE;
+
+  fwCrcStartCycles = DWT->CYCCNT;
+  return Crc32_ComputeDMA((const void*)FLASH_BASE, len, fwCrcDone);
+}
+
+/*
+ * Console lines are built on the stack and queued with a single write,
+ * copying each byte twice on purpose. The TX ring has several producers
+ * (RingBuffer_WriteMP), so a write region from RingBuffer_GetWriteRegion
+ * cannot be formatted into in place. An MP reservation would have to be
+ * sized before the line's length is known, and cannot be shrunk once a
+ * later writer has reserved behind it. The second copy is at most
+ * CONSOLE_LINE_SIZE bytes of memcpy: noise next to the time the USART
+ * takes to send them.
+ */
+static void consoleSend(Fmt *f) {
+  UART_Port_Write(&uart2Port, (uint8_t*)f->buf, f->len);
 }
 
+void printBufferStats(void) {
+#if RING_BUFFER_STATS
+  char line[CONSOLE_LINE_SIZE];
+  Fmt f;
+  RingBuffer_Stats tx, rx;
+  UART_Port *ports[] = { &uart2Port, &uart1Port };
+  uint8_t i;
+
+  for(i = 0; i < 2; i++) {
+    RingBuffer_GetStats(&ports[i]->tx, &tx);
+    RingBuffer_GetStats(&ports[i]->rx, &rx);
+    Fmt_Init(&f, line, sizeof(line));
+    Fmt_Print(&f, "\r\nUSART", 2 - i, " TX: peak ", tx.highWater, "/", ports[i]->tx.size,
+        " wr ", tx.bytesWritten, " rd ", tx.bytesRead);
+    Fmt_Print(&f, " rej ", tx.rejectedWrites, " ovf ", tx.overflows);
+    consoleSend(&f);
+    Fmt_Init(&f, line, sizeof(line));
+    Fmt_Print(&f, "\r\nUSART", 2 - i, " RX: peak ", rx.highWater, "/", ports[i]->rx.size,
+        " wr ", rx.bytesWritten, " rd ", rx.bytesRead);
+    Fmt_Print(&f, " rej ", rx.rejectedWrites, " ovf ", rx.overflows);
+    consoleSend(&f);
+  }
+#else
+  static const char msg[] = "\r\nBuffer statistics disabled";
+
+  UART_Port_Write(&uart2Port, (const uint8_t*)msg, strlen(msg));
+#endif
+}
+
+void printUartStats(void) {
+  printPortStats("USART1", &uart1Port);
+  printPortStats("USART2", &uart2Port);
+}
+
+static void printPortStats(const char *name, UART_Port *port) {
+  char line[CONSOLE_LINE_SIZE];
+  Fmt f;
+  ISR_CycleStats *isr = &port->isrCycles;
+
+  Fmt_Init(&f, line, sizeof(line));
+  Fmt_Print(&f, "\r\n", name, port->mode == UART_PORT_MODE_IRQ ? " (fast IRQ)" : " (HAL+DMA)",
+      ": ore ", port->errors.overrun, " fe ", port->errors.framing,
+      " ne ", port->errors.noise, " pe ", port->errors.parity);
+  consoleSend(&f);
+  Fmt_Init(&f, line, sizeof(line));
+  Fmt_Print(&f, "\r\nISR cycles: last ", isr->last, " max ", isr->max,
+      " avg ", isr->count ? isr->total / isr->count : 0, " over ", isr->count, " calls");
+  consoleSend(&f);
+  if(port->flow.rtsPort != NULL) {
+    Fmt_Init(&f, line, sizeof(line));
+    Fmt_Print(&f, "\r\nFlow control: RTS ", port->flow.stopped ? "deasserted" : "asserted",
+        ", dropped ", port->flow.stops, " times");
+    consoleSend(&f);
+  }
+}
+
+/*
+ * Hands both USARTs to the DMA bridge. The console is part of it, so its
+ * output (the prompt included) stays queued until the bridge is stopped.
+ */
+void startBridge(void) {
+  static const char startMsg[] = "\r\nBridging USART1 <-> USART2, press USER BUTTON to stop";
+  static const char modeMsg[] = "\r\nBridge unavailable: both ports must run HAL+DMA";
+  static const char drainMsg[] = "\r\nBridge not started: queued output did not drain, try again";
+  HAL_StatusTypeDef status;
+
+  UART_Port_Write(&uart2Port, (const uint8_t*)startMsg, strlen(startMsg));
+  status = UART_Port_BridgeStart(&uart1Port, &uart2Port);
+  if(status != HAL_OK) {
+    if(status == HAL_TIMEOUT)
+      UART_Port_Write(&uart2Port, (const uint8_t*)drainMsg, strlen(drainMsg));
+    else
+      UART_Port_Write(&uart2Port, (const uint8_t*)modeMsg, strlen(modeMsg));
+    return;
+  }
+  bridgeActive = 1;
+  bridgeStartTick = HAL_GetTick();
+}
+
+void serviceBridge(void) {
+  if(!bridgeActive || HAL_GPIO_ReadPin(GPIOB, GPIO_PIN_7) != GPIO_PIN_RESET)
+    return;
+
+  UART_Port_BridgeStop(&uart1Port, &uart2Port);
+  bridgeActive = 0;
+  printBridgeStats(HAL_GetTick() - bridgeStartTick);
+  UART_Port_Write(&uart2Port, (uint8_t*)PROMPT, strlen(PROMPT));
+}
+
+static void printBridgeStats(uint32_t elapsed) {
+  char line[CONSOLE_LINE_SIZE];
+  Fmt f;
+  UART_BridgeStats *dir[] = { &uart1Port.bridgeStats, &uart2Port.bridgeStats };
+  static const char *const dirName[] = { "\r\nUSART1->USART2: rx ", "\r\nUSART2->USART1: rx " };
+  uint32_t rate;
+  uint8_t i;
+
+  if(elapsed == 0)
+    elapsed = 1;
+  Fmt_Init(&f, line, sizeof(line));
+  Fmt_Print(&f, "\r\nBridge ran ", elapsed, " ms");
+  consoleSend(&f);
+  for(i = 0; i < 2; i++) {
+    /* KiB/s with two decimals */
+    rate = (uint32_t)((uint64_t)dir[i]->txBytes * 100000 / 1024 / elapsed);
+    Fmt_Init(&f, line, sizeof(line));
+    Fmt_Print(&f, dirName[i], dir[i]->rxBytes, " tx ", dir[i]->txBytes,
+        " drop ", dir[i]->dropped, " (");
+    Fmt_Fixed(&f, (int32_t)rate, 2);
+    Fmt_Str(&f, " KiB/s)");
+    consoleSend(&f);
+  }
+}
+
+static void fwCrcDone(uint32_t crc, uint8_t ok) {
+  fwCrcCycles = DWT->CYCCNT - fwCrcStartCycles;
+  fwCrc = crc;
+  fwCrcOk = ok;
+  fwCrcReady = 1;
+}
+
+void serviceFirmwareCrc(void) {
+  char line[CONSOLE_LINE_SIZE];
+  Fmt f;
+
+  if(!fwCrcReady)
+    return;
+  fwCrcReady = 0;
+
+  /* A DMA transfer error: start over from here rather than from the interrupt */
+  if(!fwCrcOk) {
+    if(fwCrcRetries > 0) {
+      fwCrcRetries--;
+      if(startFirmwareCrc())
+        return;
+    }
+    consoleReply("Firmware CRC failed: DMA transfer error");
+    return;
+  }
+
+  Fmt_Init(&f, line, sizeof(line));
+  Fmt_Str(&f, "Firmware CRC32: 0x");
+  Fmt_Hex(&f, fwCrc, 8);
+  Fmt_Print(&f, " (", fwCrcCycles / (HAL_RCC_GetHCLKFreq() / 1000000), " us)", PROMPT);
+  consoleSend(&f);
+}
+
+static uint32_t portErrors(UART_Port *port) {
+  return port->errors.overrun + port->errors.framing + port->errors.noise + port->errors.parity;
+}
+
+/*
+ * Called once the acknowledgement is queued: it still has to leave at the
+ * old rate, so the switch waits in applyBaud until the port and the
+ * console have drained. prompt sends the console prompt after the switch.
+ */
+static void switchBaud(BaudLink *link, uint32_t baud, uint8_t prompt) {
+  link->pendingBaud = baud;
+  link->pendingTick = HAL_GetTick();
+  link->pendingProbation = 1;
+  link->pendingPrompt = prompt;
+  applyBaud(link);
+}
+
+/* Runs every main loop pass: makes a pending switch once nothing is left to send at the old rate */
+static void applyBaud(BaudLink *link) {
+  char line[CONSOLE_LINE_SIZE];
+  Fmt f;
+
+  if(link->pendingBaud == 0)
+    return;
+
+  if(!UART_Port_TxDone(&uart2Port) || !UART_Port_TxDone(link->port)) {
+    if((HAL_GetTick() - link->pendingTick) < BAUD_DRAIN_TIMEOUT)
+      return;
+    /* Output stuck, e.g. held off by CTS: switching now would garble it */
+    link->pendingBaud = 0;
+    Fmt_Init(&f, line, sizeof(line));
+    Fmt_Print(&f, "\r\n", link->name, " stays at ", UART_Port_GetBaud(link->port),
+        " baud: queued output did not drain", PROMPT);
+    consoleSend(&f);
+    return;
+  }
+
+  UART_Port_SetBaud(link->port, link->pendingBaud);
+  link->pendingBaud = 0;
+  link->probation = link->pendingProbation;
+  link->switchTick = HAL_GetTick();
+  link->errorMark = portErrors(link->port);
+  if(link->probation) {
+    if(link->pendingPrompt)
+      consoleReply("");
+    return;
+  }
+
+  Fmt_Init(&f, line, sizeof(line));
+  Fmt_Print(&f, "\r\n", link->name, " fell back to ", UART_Port_GetBaud(link->port), " baud", PROMPT);
+  consoleSend(&f);
+}
+
+static void confirmBaud(BaudLink *link) {
+  if(!link->probation)
+    return;
+  link->probation = 0;
+  link->goodBaud = link->port->huart->Init.BaudRate;
+}
+
+/*
+ * Watches the receive error rate of every port and the probation deadline
+ * of a fresh rate. A failed probation returns to the last rate that worked;
+ * errors at a confirmed rate drop back to the boot rate.
+ */
+void serviceBaud(void) {
+  static uint32_t lastRun;
+  BaudLink *link;
+  uint32_t errors, baud;
+  uint8_t i, fallback;
+
+  applyBaud(&baudLinks[0]);
+  applyBaud(&baudLinks[1]);
+  if((HAL_GetTick() - lastRun) < BAUD_CHECK_PERIOD)
+    return;
+  lastRun = HAL_GetTick();
+
+  for(i = 0; i < 2; i++) {
+    link = &baudLinks[i];
+    /* Still at the old rate: its errors are not the new rate's */
+    if(link->pendingBaud != 0)
+      continue;
+    errors = portErrors(link->port);
+    fallback = errors - link->errorMark > BAUD_ERROR_LIMIT;
+    link->errorMark = errors;
+
+    if(!fallback && link->probation && (HAL_GetTick() - link->switchTick) >= BAUD_PROBATION) {
+      /* The console rate needs the host to answer at it; USART1 only has to stay clean */
+      if(link->port == &uart2Port)
+        fallback = 1;
+      else
+        confirmBaud(link);
+    }
+    if(!fallback)
+      continue;
+
+    baud = link->probation ? link->goodBaud : link->bootBaud;
+    link->goodBaud = baud;
+    link->probation = 0;
+    if(baud == link->port->huart->Init.BaudRate)
+      continue;
+    link->pendingBaud = baud;
+    link->pendingTick = HAL_GetTick();
+    link->pendingProbation = 0;
+    link->pendingPrompt = 0;
+    applyBaud(link);
+  }
+}
+
+/* Runs every CRITICAL_TASK_PERIOD ms without blocking the console in between */
 void performCriticalTasks(void) {
-  HAL_Delay(100);
+  static uint32_t lastRun;
+
+  if((HAL_GetTick() - lastRun) < CRITICAL_TASK_PERIOD)
+    return;
+  lastRun = HAL_GetTick();
 }
 
-void printWelcomeMessage(void) {
-  char *strings[] = {"\033[0;0H", "\033[2J", WELCOME_MSG, MAIN_MENU, PROMPT};
+/*
+ * Overrides the weak _write in syscalls.c: stdout and stderr go to the
+ * console TX ring as one span per call and return at once. Whatever
+ * STDOUT_POLICY drops is reported as written, since newlib would otherwise
+ * retry the remainder and stall.
+ */
+int _write(int file, char *ptr, int len) {
+  int done, chunk;
+
+  if(file != STDOUT_FILENO && file != STDERR_FILENO) {
+    errno = EBADF;
+    return -1;
+  }
 
-  for (uint8_t i = 0; i < 5; i++) {
-    //HAL_UART_Transmit_IT(&huart2, (uint8_t*)strings[i], strlen(strings[i]));
-    UART_Transmit(&huart2, (uint8_t*)strings[i], strlen(strings[i]));
-    while (HAL_UART_GetState(&huart2) == HAL_UART_STATE_BUSY_TX || HAL_UART_GetState(&huart2) == HAL_UART_STATE_BUSY_TX_RX);
+  /* Spans never get near 64 KB in practice, but the port takes 16-bit lengths */
+  for(done = 0; done < len; done += chunk) {
+    chunk = len - done > UINT16_MAX ? UINT16_MAX : len - done;
+    UART_Port_WritePolicy(&uart2Port, (const uint8_t*)ptr + done, (uint16_t)chunk, STDOUT_POLICY);
   }
+  return len;
+}
+
+void printWelcomeMessage(void) {
+  UART_Port_WriteConst(&uart2Port, (const uint8_t*)welcomeScreen, sizeof(welcomeScreen) - 1);
 }
 
 /**
@@ -415,6 +1063,31 @@ static void MX_USB_PCD_Init(void)
 }
 
 
+/** 
+  * Enable DMA controller clock
+  */
+static void MX_DMA_Init(void) 
+{
+
+  /* DMA controller clock enable */
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  /* DMA interrupt init */
+  /* DMA1_Channel4_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel4_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel4_IRQn);
+  /* DMA1_Channel5_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel5_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel5_IRQn);
+  /* DMA1_Channel6_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel6_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel6_IRQn);
+  /* DMA1_Channel7_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel7_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel7_IRQn);
+
+}
+
 /**
   * @brief GPIO Initialization Function
   * @param None
@@ -0,0 +1,214 @@
+/*
+ * Host micro-benchmark for Src/ringbuffer.c: ns per byte moved through
+ * RingBuffer_Write and RingBuffer_Read, alone and interleaved, across
+ * capacities and transfer sizes. The "loop" columns run the buffer as it
+ * was before the series, copied verbatim below: a fixed 1000-byte array,
+ * % RING_BUFFER_LENGTH and a head/tail store on every byte. Its capacity
+ * is 999 whatever the row says. The "copy" columns run the library, which
+ * also keeps the RING_BUFFER_STATS counters unless built with
+ * -DRING_BUFFER_STATS=0. Absolute numbers are the host's, not the
+ * Cortex-M3's; the point is the ratio, and comparing runs before and after
+ * a change. Each figure is the best of REPEATS runs, which keeps a busy
+ * host from showing up as a slowdown.
+ *
+ *   ./bench_ringbuffer [MB per measurement]
+ */
+#include "ringbuffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static uint8_t storage[RING_BUFFER_MAX_LENGTH];
+static uint8_t chunk[RING_BUFFER_MAX_LENGTH];
+static uint32_t totalBytes = 8u << 20;
+static volatile uint32_t sink;
+
+static const uint16_t capacities[] = { 64, 256, 1024, 4096, 32768 };
+static const uint16_t chunkSizes[] = { 1, 16, 256 };
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+#define REPEATS  5
+
+/* Fastest of REPEATS evaluations of a measurement */
+#define BEST(expr) ({ \
+		double t_, best_ = 1e30; \
+		int r_; \
+		for(r_ = 0; r_ < REPEATS; r_++) { \
+			t_ = (expr); \
+			if(t_ < best_) \
+				best_ = t_; \
+		} \
+		best_; \
+	})
+
+/* Baseline: the original Inc/ringbuffer.h and Src/ringbuffer.c, renamed */
+#define RING_BUFFER_LENGTH 1000
+
+typedef struct {
+	uint8_t buf[RING_BUFFER_LENGTH];
+	uint16_t head, tail;
+} LegacyRing;
+
+static uint16_t legacyGetFreeSpace(LegacyRing *buf) {
+	if(buf->tail == buf->head)
+		return RING_BUFFER_LENGTH - 1;
+
+	if(buf->head > buf->tail)
+		return RING_BUFFER_LENGTH - ((buf->head - buf->tail) + 1);
+	else
+		return  (buf->tail - buf->head) - 1;
+}
+
+/* noinline keeps the call cost level with the library's */
+__attribute__((noinline))
+static uint16_t legacyRead(LegacyRing *buf, uint8_t *data, uint16_t len) {
+	uint16_t counter = 0;
+
+	while(buf->tail != buf->head && counter < len) {
+		data[counter++] = buf->buf[buf->tail];
+		buf->tail = (buf->tail + 1) % RING_BUFFER_LENGTH;
+	}
+	return counter;
+}
+
+__attribute__((noinline))
+static uint8_t legacyWrite(LegacyRing *buf, uint8_t *data, uint16_t len) {
+	uint16_t counter = 0;
+	uint16_t freeSpace = legacyGetFreeSpace(buf);
+
+	if(freeSpace == 0)
+		return RING_BUFFER_FULL;
+	else if (freeSpace < len)
+		return RING_BUFFER_NO_SUFFICIENT_SPACE;
+
+	while(counter < len) {
+		buf->buf[buf->head] = data[counter++];
+		buf->head = (buf->head + 1) % RING_BUFFER_LENGTH;
+	}
+	return RING_BUFFER_OK;
+}
+
+static LegacyRing legacy;
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Fills the buffer chunk by chunk, then empties it in O(1) without copying */
+static double benchWrite(RingBuffer *rb, uint16_t len) {
+	uint32_t moved = 0;
+	double start = now();
+
+	while(moved < totalBytes) {
+		while(RingBuffer_Write(rb, chunk, len) == RING_BUFFER_OK)
+			moved += len;
+		RingBuffer_Consume(rb, RingBuffer_GetDataLength(rb));
+	}
+	return (now() - start) / moved;
+}
+
+/* Fills the buffer in O(1) without copying, then drains it chunk by chunk */
+static double benchRead(RingBuffer *rb, uint16_t len) {
+	uint32_t moved = 0;
+	uint16_t got;
+	double start = now();
+
+	while(moved < totalBytes) {
+		RingBuffer_Commit(rb, RingBuffer_GetFreeSpace(rb));
+		while((got = RingBuffer_Read(rb, chunk, len)) > 0)
+			moved += got;
+	}
+	sink += chunk[0];
+	return (now() - start) / moved;
+}
+
+/* Steady state around half full: one write, one read */
+static double benchMixed(RingBuffer *rb, uint16_t len) {
+	uint32_t moved = 0;
+	double start;
+
+	RingBuffer_Commit(rb, rb->size / 2);
+	start = now();
+	while(moved < totalBytes) {
+		RingBuffer_Write(rb, chunk, len);
+		moved += RingBuffer_Read(rb, chunk, len);
+	}
+	return (now() - start) / (2.0 * moved);
+}
+
+/* The same three on the original buffer, filled and emptied by moving its indices */
+static double legacyBenchWrite(uint16_t len) {
+	uint32_t moved = 0;
+	double start = now();
+
+	while(moved < totalBytes) {
+		while(legacyWrite(&legacy, chunk, len) == RING_BUFFER_OK)
+			moved += len;
+		legacy.tail = legacy.head;
+	}
+	return (now() - start) / moved;
+}
+
+static double legacyBenchRead(uint16_t len) {
+	uint32_t moved = 0;
+	uint16_t got;
+	double start = now();
+
+	while(moved < totalBytes) {
+		legacy.head = (legacy.tail + RING_BUFFER_LENGTH - 1) % RING_BUFFER_LENGTH;
+		while((got = legacyRead(&legacy, chunk, len)) > 0)
+			moved += got;
+	}
+	sink += chunk[0];
+	return (now() - start) / moved;
+}
+
+static double legacyBenchMixed(uint16_t len) {
+	uint32_t moved = 0;
+	double start;
+
+	legacy.head = (legacy.tail + RING_BUFFER_LENGTH / 2) % RING_BUFFER_LENGTH;
+	start = now();
+	while(moved < totalBytes) {
+		legacyWrite(&legacy, chunk, len);
+		moved += legacyRead(&legacy, chunk, len);
+	}
+	return (now() - start) / (2.0 * moved);
+}
+
+int main(int argc, char **argv) {
+	RingBuffer rb;
+	uint32_t c, l;
+	uint16_t len;
+
+	if(argc > 1)
+		totalBytes = (uint32_t)strtoul(argv[1], NULL, 0) << 20;
+
+	printf("%-9s %-6s %9s %9s %9s   (ns/byte)\n", "capacity", "chunk", "write", "read", "mixed");
+	/* Before: the original buffer, whose capacity is fixed */
+	for(l = 0; l < COUNT(chunkSizes); l++) {
+		len = chunkSizes[l];
+		printf("%-9s %-6u", "orig 999", len);
+		printf(" %9.3f", BEST(legacyBenchWrite(len)));
+		printf(" %9.3f", BEST(legacyBenchRead(len)));
+		printf(" %9.3f\n", BEST(legacyBenchMixed(len)));
+	}
+	for(c = 0; c < COUNT(capacities); c++) {
+		if(capacities[c] > RING_BUFFER_MAX_LENGTH)
+			continue;
+		for(l = 0; l < COUNT(chunkSizes); l++) {
+			len = chunkSizes[l];
+			/* Mixed needs the chunk to fit beside the half-full fill */
+			if(len > capacities[c] / 2)
+				continue;
+			printf("%-9u %-6u", capacities[c], len);
+			printf(" %9.3f", BEST((RingBuffer_Init(&rb, storage, capacities[c]), benchWrite(&rb, len))));
+			printf(" %9.3f", BEST((RingBuffer_Init(&rb, storage, capacities[c]), benchRead(&rb, len))));
+			printf(" %9.3f\n", BEST((RingBuffer_Init(&rb, storage, capacities[c]), benchMixed(&rb, len))));
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * Just enough of the STM32F1 HAL and CMSIS for Src/uart_port.c to build on
+ * the host. Registers are plain memory and the HAL calls are implemented by
+ * the test, which plays the USART, the DMA and the device on the other end.
+ * Bit values match the reference manual, so the driver's masks mean the
+ * same thing here.
+ */
+#ifndef STM32F1XX_HAL_STUB_H__
+#define STM32F1XX_HAL_STUB_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define __IO volatile
+
+typedef enum {
+	HAL_OK = 0x00,
+	HAL_ERROR = 0x01,
+	HAL_BUSY = 0x02,
+	HAL_TIMEOUT = 0x03
+} HAL_StatusTypeDef;
+
+typedef struct {
+	__IO uint32_t SR;
+	__IO uint32_t DR;
+	__IO uint32_t BRR;
+	__IO uint32_t CR1;
+	__IO uint32_t CR2;
+	__IO uint32_t CR3;
+	__IO uint32_t GTPR;
+} USART_TypeDef;
+
+typedef struct {
+	__IO uint32_t CRL;
+	__IO uint32_t CRH;
+	__IO uint32_t IDR;
+	__IO uint32_t ODR;
+	__IO uint32_t BSRR;
+	__IO uint32_t BRR;
+	__IO uint32_t LCKR;
+} GPIO_TypeDef;
+
+typedef struct {
+	__IO uint32_t CCR;
+	__IO uint32_t CNDTR;
+	__IO uint32_t CPAR;
+	__IO uint32_t CMAR;
+} DMA_Channel_TypeDef;
+
+/* The test defines the instance busClock compares against */
+extern USART_TypeDef Sim_USART1;
+#define USART1 (&Sim_USART1)
+
+#define USART_SR_PE     0x0001
+#define USART_SR_FE     0x0002
+#define USART_SR_NE     0x0004
+#define USART_SR_ORE    0x0008
+#define USART_SR_IDLE   0x0010
+#define USART_SR_RXNE   0x0020
+#define USART_SR_TC     0x0040
+#define USART_SR_TXE    0x0080
+
+#define USART_CR1_IDLEIE 0x0010
+#define USART_CR1_RXNEIE 0x0020
+#define USART_CR1_TCIE   0x0040
+#define USART_CR1_TXEIE  0x0080
+#define USART_CR1_UE     0x2000
+#define USART_CR3_CTSE   0x0200
+
+#define GPIO_PIN_1  0x0002
+#define GPIO_PIN_12 0x1000
+
+typedef struct {
+	DMA_Channel_TypeDef *Instance;
+} DMA_HandleTypeDef;
+
+#define DMA_IT_HT 0x0004
+
+typedef enum {
+	HAL_UART_STATE_RESET = 0x00,
+	HAL_UART_STATE_READY = 0x20,
+	HAL_UART_STATE_BUSY_RX = 0x22
+} HAL_UART_StateTypeDef;
+
+#define HAL_UART_ERROR_NONE 0x00
+#define HAL_UART_ERROR_PE   0x01
+#define HAL_UART_ERROR_NE   0x02
+#define HAL_UART_ERROR_FE   0x04
+#define HAL_UART_ERROR_ORE  0x08
+
+#define UART_HWCONTROL_NONE 0x0000
+#define UART_HWCONTROL_CTS  USART_CR3_CTSE
+
+typedef struct {
+	uint32_t BaudRate;
+	uint32_t HwFlowCtl;
+} UART_InitTypeDef;
+
+typedef struct {
+	USART_TypeDef *Instance;
+	UART_InitTypeDef Init;
+	DMA_HandleTypeDef *hdmatx;
+	DMA_HandleTypeDef *hdmarx;
+	__IO HAL_UART_StateTypeDef RxState;
+	__IO uint32_t ErrorCode;
+} UART_HandleTypeDef;
+
+/* The real UART_IT_IDLE also encodes the register; CR1 is the only one used here */
+#define UART_IT_IDLE USART_CR1_IDLEIE
+
+#define SET_BIT(REG, BIT)   ((REG) |= (BIT))
+#define CLEAR_BIT(REG, BIT) ((REG) &= ~(BIT))
+
+#define __HAL_UART_ENABLE_IT(h, it)     SET_BIT((h)->Instance->CR1, (it))
+#define __HAL_UART_GET_IT_SOURCE(h, it) (((h)->Instance->CR1 & (it)) != 0)
+#define __HAL_DMA_GET_COUNTER(h)        ((h)->Instance->CNDTR)
+#define __HAL_DMA_DISABLE_IT(h, it)     CLEAR_BIT((h)->Instance->CCR, (it))
+
+/* Copied from stm32f1xx_hal_uart.h so BRR rounds exactly as on the target */
+#define UART_DIV_SAMPLING16(_PCLK_, _BAUD_)            (((_PCLK_)*25U)/(4U*(_BAUD_)))
+#define UART_DIVMANT_SAMPLING16(_PCLK_, _BAUD_)        (UART_DIV_SAMPLING16((_PCLK_), (_BAUD_))/100U)
+#define UART_DIVFRAQ_SAMPLING16(_PCLK_, _BAUD_)        (((UART_DIV_SAMPLING16((_PCLK_), (_BAUD_)) - (UART_DIVMANT_SAMPLING16((_PCLK_), (_BAUD_)) * 100U)) * 16U + 50U) / 100U)
+#define UART_BRR_SAMPLING16(_PCLK_, _BAUD_)            (((UART_DIVMANT_SAMPLING16((_PCLK_), (_BAUD_)) << 4U) + \
+                                                        (UART_DIVFRAQ_SAMPLING16((_PCLK_), (_BAUD_)) & 0xF0U)) + \
+                                                        (UART_DIVFRAQ_SAMPLING16((_PCLK_), (_BAUD_)) & 0x0FU))
+
+/* One thread of execution: interrupts are whatever the test calls */
+static inline uint32_t __get_PRIMASK(void) { return 0; }
+static inline void __set_PRIMASK(uint32_t primask) { (void)primask; }
+static inline void __disable_irq(void) { }
+
+uint32_t HAL_GetTick(void);
+uint32_t HAL_RCC_GetPCLK1Freq(void);
+uint32_t HAL_RCC_GetPCLK2Freq(void);
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_UART_AbortTransmit(UART_HandleTypeDef *huart);
+void HAL_UART_IRQHandler(UART_HandleTypeDef *huart);
+
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart);
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart);
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart);
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart);
+
+#endif /* STM32F1XX_HAL_STUB_H__ */
@@ -0,0 +1,147 @@
+/*
+ * Tests for Src/cmdtable.c and the CMD_HASH macro in Inc/cmdtable.h. The
+ * compile-time hash must equal Cmd_Hash for every name length it covers,
+ * the console's own command names included, and Cmd_Find must select by
+ * number only for an in-range decimal and by name only on an exact match,
+ * even when two names share a hash.
+ *
+ *   ./test_cmdtable [seed]
+ */
+#include "cmdtable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUNDS 100000
+
+static uint32_t seed, rngState;
+
+#define CHECK(cond) do { \
+		if(!(cond)) { \
+			fprintf(stderr, "%s:%d: %s failed (seed %u)\n", __FILE__, __LINE__, #cond, seed); \
+			exit(1); \
+		} \
+	} while(0)
+
+static uint32_t rnd(void) {
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState;
+}
+
+#define ENTRY(name) { name, CMD_HASH(name), NULL, NULL }
+
+/* The names src/main.c registers, in menu order; a static initializer, so CMD_HASH must fold */
+static const Cmd console[] = {
+	ENTRY("led"), ENTRY("button"), ENTRY("menu"), ENTRY("bufstats"),
+	ENTRY("uartstats"), ENTRY("bridge"), ENTRY("fwcrc"), ENTRY("baud"),
+};
+#define CONSOLE_COUNT ((uint8_t)(sizeof(console) / sizeof(console[0])))
+
+/* "costarring" and "liquid" are an FNV-1a collision */
+static const Cmd colliding[] = { ENTRY("costarring") };
+
+#define CHECK_HASH(s) CHECK(CMD_HASH(s) == Cmd_Hash(s))
+
+static void testHash(void) {
+	uint8_t i;
+
+	CHECK_HASH("");
+	CHECK(Cmd_Hash("") == 2166136261u);
+	CHECK_HASH("a");
+	CHECK(Cmd_Hash("a") == 0xE40C292Cu);
+	CHECK_HASH("ab");
+	CHECK_HASH("fifteen-chars-x");
+	CHECK_HASH("sixteen-chars-xy");
+	CHECK_HASH("\x80\xff\x7f");
+	CHECK_HASH("\xe4\xb8\xad");
+	for(i = 0; i < CONSOLE_COUNT; i++)
+		CHECK(console[i].hash == Cmd_Hash(console[i].name));
+	CHECK(CMD_HASH("costarring") == CMD_HASH("liquid"));
+}
+
+static void testFindNumber(void) {
+	static Cmd big[255];
+	static char names[255][5];
+	char word[8];
+	uint8_t i;
+
+	for(i = 0; i < CONSOLE_COUNT; i++) {
+		snprintf(word, sizeof(word), "%u", i + 1);
+		CHECK(Cmd_Find(console, CONSOLE_COUNT, word) == &console[i]);
+	}
+	CHECK(Cmd_Find(console, CONSOLE_COUNT, "01") == &console[0]);
+	CHECK(Cmd_Find(console, CONSOLE_COUNT, "0") == NULL);
+	CHECK(Cmd_Find(console, CONSOLE_COUNT, "9") == NULL);
+	CHECK(Cmd_Find(console, CONSOLE_COUNT, "10") == NULL);
+	CHECK(Cmd_Find(console, CONSOLE_COUNT, "256") == NULL);
+	CHECK(Cmd_Find(console, CONSOLE_COUNT, "4294967297") == NULL);
+	CHECK(Cmd_Find(console, CONSOLE_COUNT, "1a") == NULL);
+	CHECK(Cmd_Find(console, CONSOLE_COUNT, "-1") == NULL);
+	CHECK(Cmd_Find(console, CONSOLE_COUNT, "") == NULL);
+	CHECK(Cmd_Find(console, 0, "1") == NULL);
+
+	/* The largest table a uint8_t count allows: three digits, and one past it */
+	for(i = 0; i < 255; i++) {
+		snprintf(names[i], sizeof(names[i]), "c%u", i);
+		big[i].name = names[i];
+		big[i].hash = Cmd_Hash(names[i]);
+	}
+	CHECK(Cmd_Find(big, 255, "255") == &big[254]);
+	CHECK(Cmd_Find(big, 255, "100") == &big[99]);
+	CHECK(Cmd_Find(big, 255, "256") == NULL);
+	CHECK(Cmd_Find(big, 255, "2550") == NULL);
+	CHECK(Cmd_Find(big, 255, "c254") == &big[254]);
+}
+
+static void testFindName(void) {
+	char word[CMD_NAME_MAX + 2];
+	uint32_t round;
+	uint8_t i, len;
+
+	for(i = 0; i < CONSOLE_COUNT; i++)
+		CHECK(Cmd_Find(console, CONSOLE_COUNT, console[i].name) == &console[i]);
+	CHECK(Cmd_Find(console, CONSOLE_COUNT, "le") == NULL);
+	CHECK(Cmd_Find(console, CONSOLE_COUNT, "leds") == NULL);
+	CHECK(Cmd_Find(console, CONSOLE_COUNT, "LED") == NULL);
+	CHECK(Cmd_Find(console, CONSOLE_COUNT, "bufstat") == NULL);
+
+	/* Equal hashes, different names: the strcmp has the last word */
+	CHECK(Cmd_Find(colliding, 1, "costarring") == &colliding[0]);
+	CHECK(Cmd_Find(colliding, 1, "liquid") == NULL);
+
+	/* Random words only ever find the entry with their exact name */
+	for(round = 0; round < ROUNDS; round++) {
+		i = (uint8_t)(rnd() % CONSOLE_COUNT);
+		strcpy(word, console[i].name);
+		len = (uint8_t)strlen(word);
+		switch(rnd() % 3) {
+		case 0:
+			word[rnd() % len] = (char)('a' + rnd() % 26);
+			break;
+		case 1:
+			word[rnd() % len] = '\0';
+			break;
+		default:
+			word[len] = (char)('a' + rnd() % 26);
+			word[len + 1] = '\0';
+			break;
+		}
+		if(strcmp(word, console[i].name) == 0)
+			CHECK(Cmd_Find(console, CONSOLE_COUNT, word) == &console[i]);
+		else if(Cmd_Find(console, CONSOLE_COUNT, word) != NULL)
+			CHECK(strcmp(Cmd_Find(console, CONSOLE_COUNT, word)->name, word) == 0);
+	}
+}
+
+int main(int argc, char **argv) {
+	seed = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 0x5EED1234u;
+	rngState = seed ? seed : 1;
+
+	testHash();
+	testFindNumber();
+	testFindName();
+	printf("test_cmdtable: seed %u: OK\n", seed);
+	return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * Tests for Src/fmt.c against snprintf: decimal, hex and fixed-point
+ * output over random and edge values, Fmt_Print's type dispatch, and
+ * truncation when the buffer runs out, which must never write past it.
+ *
+ *   ./test_fmt [seed]
+ */
+#include "fmt.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUNDS 200000
+#define GUARD  0x5A
+
+static uint32_t seed, rngState;
+static char buf[64 + 8];
+static char expect[64];
+
+#define CHECK(cond) do { \
+		if(!(cond)) { \
+			fprintf(stderr, "%s:%d: %s failed (seed %u)\n", __FILE__, __LINE__, #cond, seed); \
+			exit(1); \
+		} \
+	} while(0)
+
+/* Compares the builder's output with expect, and that the guard bytes after it are untouched */
+#define CHECK_OUT(f) do { \
+		CHECK((f)->len == strlen(expect)); \
+		CHECK(memcmp(buf, expect, (f)->len) == 0); \
+		CHECK((uint8_t)buf[(f)->size] == GUARD); \
+	} while(0)
+
+static uint32_t rnd(void) {
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState;
+}
+
+/* Values of every magnitude, not just the large ones uniform bits give */
+static uint32_t rndValue(void) {
+	return rnd() >> (rnd() % 32);
+}
+
+static void start(Fmt *f, uint16_t size) {
+	memset(buf, GUARD, sizeof(buf));
+	Fmt_Init(f, buf, size);
+}
+
+/* Reference for Fmt_Fixed: integer part, then the low decimals digits zero padded */
+static void fixedReference(int32_t v, uint8_t decimals) {
+	uint32_t u = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+	uint32_t scale = 1;
+	uint8_t i;
+
+	for(i = 0; i < decimals; i++)
+		scale *= 10;
+	if(decimals == 0)
+		snprintf(expect, sizeof(expect), "%s%" PRIu32, v < 0 ? "-" : "", u);
+	else
+		snprintf(expect, sizeof(expect), "%s%" PRIu32 ".%0*" PRIu32, v < 0 ? "-" : "",
+				u / scale, (int)decimals, u % scale);
+}
+
+static void testNumbers(void) {
+	static const int32_t edges[] = { 0, 1, -1, 9, 10, -10, 99, 100, INT32_MAX, INT32_MIN, INT32_MIN + 1 };
+	Fmt f;
+	uint32_t round, u;
+	int32_t v;
+	uint8_t digits, decimals;
+
+	for(round = 0; round < ROUNDS; round++) {
+		u = round < sizeof(edges) / sizeof(edges[0]) ? (uint32_t)edges[round] : rndValue();
+		v = (int32_t)u;
+
+		start(&f, 64);
+		Fmt_Uint(&f, u);
+		snprintf(expect, sizeof(expect), "%" PRIu32, u);
+		CHECK_OUT(&f);
+
+		start(&f, 64);
+		Fmt_Int(&f, v);
+		snprintf(expect, sizeof(expect), "%" PRId32, v);
+		CHECK_OUT(&f);
+
+		/* Widths past 8 are clamped, 0 still prints one digit */
+		digits = (uint8_t)(rnd() % 11);
+		start(&f, 64);
+		Fmt_Hex(&f, u, digits);
+		snprintf(expect, sizeof(expect), "%0*" PRIX32, digits > 8 ? 8 : digits, u);
+		CHECK_OUT(&f);
+
+		decimals = (uint8_t)(rnd() % 10);
+		start(&f, 64);
+		Fmt_Fixed(&f, v, decimals);
+		fixedReference(v, decimals);
+		CHECK_OUT(&f);
+	}
+
+	/* Signs of values smaller than one unit */
+	start(&f, 64);
+	Fmt_Fixed(&f, -5, 2);
+	strcpy(expect, "-0.05");
+	CHECK_OUT(&f);
+	start(&f, 64);
+	Fmt_Fixed(&f, 5, 3);
+	strcpy(expect, "0.005");
+	CHECK_OUT(&f);
+}
+
+static void testPrint(void) {
+	const char *name = "USART2";
+	char *mutableName = (char *)"rx";
+	Fmt f;
+
+	start(&f, 64);
+	Fmt_Print(&f, "\r\n", name, (char)':', (uint8_t)200, (int16_t)-7,
+			(unsigned long)4000000000u, -12, 3u, mutableName, (signed char)-1, (unsigned short)65535);
+	strcpy(expect, "\r\nUSART2:200-74000000000-123rx-165535");
+	CHECK_OUT(&f);
+}
+
+/* Whatever the routine, output stops exactly at size and the rest is dropped */
+static void testTruncation(void) {
+	Fmt f;
+	uint16_t size;
+	uint32_t round;
+
+	for(round = 0; round < ROUNDS / 10; round++) {
+		size = (uint16_t)(rnd() % 12);
+		start(&f, size);
+		switch(rnd() % 5) {
+		case 0:
+			Fmt_Str(&f, "hello, world");
+			strcpy(expect, "hello, world");
+			break;
+		case 1:
+			Fmt_Int(&f, INT32_MIN);
+			strcpy(expect, "-2147483648");
+			break;
+		case 2:
+			Fmt_Hex(&f, 0xDEADBEEF, 8);
+			strcpy(expect, "DEADBEEF");
+			break;
+		case 3:
+			Fmt_Fixed(&f, -123456, 3);
+			strcpy(expect, "-123.456");
+			break;
+		default:
+			Fmt_Print(&f, "ab", (char)'c', 1234u);
+			strcpy(expect, "abc1234");
+			break;
+		}
+		if(strlen(expect) > size)
+			expect[size] = '\0';
+		CHECK_OUT(&f);
+	}
+}
+
+int main(int argc, char **argv) {
+	seed = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 0x5EED1234u;
+	rngState = seed ? seed : 1;
+
+	testNumbers();
+	testPrint();
+	testTruncation();
+	printf("test_fmt: seed %u: OK\n", seed);
+	return 0;
+}
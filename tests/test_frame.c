@@ -0,0 +1,237 @@
+/*
+ * Host loopback test for the binary protocol: random frames are encoded
+ * with Frame_Encode, streamed through a RingBuffer in uneven pieces, picked
+ * up with FrameReader the way pollConsole does, and decoded again. Also
+ * checks CRC-32 against a bitwise reference, COBS round trips, and that
+ * corrupted or oversized frames are rejected.
+ *
+ *   ./test_frame [seed]
+ */
+#include "frame.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUNDS    20000
+#define RING_SIZE 256
+
+static uint32_t seed, rngState;
+
+#define CHECK(cond) do { \
+		if(!(cond)) { \
+			fprintf(stderr, "%s:%d: %s failed (seed %u)\n", __FILE__, __LINE__, #cond, seed); \
+			exit(1); \
+		} \
+	} while(0)
+
+static uint32_t rnd(void) {
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState;
+}
+
+/* Zeros and long non-zero runs are what COBS has to get right */
+static void fillRandom(uint8_t *p, uint16_t len) {
+	uint8_t zeroOdds = (uint8_t)(rnd() % 4);
+	uint16_t i;
+
+	for(i = 0; i < len; i++)
+		p[i] = (rnd() % 8) < zeroOdds ? 0 : (uint8_t)(1 + rnd() % 255);
+}
+
+/* Reference: CRC-32/MPEG-2 over little endian words, then the tail bytes */
+static uint32_t crcReference(const uint8_t *p, uint32_t len) {
+	uint32_t crc = 0xFFFFFFFF, i, n = len & ~3u;
+	uint8_t bit, order[4] = { 3, 2, 1, 0 };
+
+	for(i = 0; i < len; i++) {
+		crc ^= (uint32_t)p[i < n ? (i & ~3u) + order[i & 3] : i] << 24;
+		for(bit = 0; bit < 8; bit++)
+			crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+	}
+	return crc;
+}
+
+static void testCrc(void) {
+	static const uint8_t word[] = { 0x78, 0x56, 0x34, 0x12 };
+	uint8_t data[300];
+	Crc32_Context ctx;
+	uint32_t round, len, split;
+
+	/* The CRC unit fed the single word 0x12345678 */
+	CHECK(Crc32_Compute(word, sizeof(word)) == 0xDF8A8A2B);
+
+	for(round = 0; round < ROUNDS; round++) {
+		len = rnd() % sizeof(data);
+		split = len ? rnd() % (len + 1) : 0;
+		fillRandom(data, (uint16_t)len);
+		CHECK(Crc32_Compute(data, len) == crcReference(data, len));
+
+		Crc32_Begin(&ctx);
+		Crc32_Update(&ctx, data, split);
+		Crc32_Update(&ctx, data + split, len - split);
+		CHECK(Crc32_End(&ctx) == crcReference(data, len));
+	}
+}
+
+static void testCobs(void) {
+	uint8_t data[600], enc[COBS_MAX_ENCODED(600)], dec[600];
+	uint16_t round, len, encLen, i;
+
+	for(round = 0; round < ROUNDS / 10; round++) {
+		len = (uint16_t)(1 + rnd() % sizeof(data));
+		fillRandom(data, len);
+		encLen = Cobs_Encode(data, len, enc);
+		CHECK(encLen <= COBS_MAX_ENCODED(len));
+		for(i = 0; i < encLen; i++)
+			CHECK(enc[i] != 0);
+		CHECK(Cobs_Decode(enc, encLen, dec) == len);
+		CHECK(memcmp(data, dec, len) == 0);
+		/* In place, as Frame_Decode does it */
+		CHECK(Cobs_Decode(enc, encLen, enc) == len);
+		CHECK(memcmp(data, enc, len) == 0);
+	}
+}
+
+/* Receiver side of pollConsole: a leading NUL switches to frame mode */
+typedef struct {
+	FrameReader reader;
+	uint8_t buf[COBS_MAX_ENCODED(FRAME_MAX_RAW)];
+	uint8_t frameMode;
+} Receiver;
+
+static int16_t receive(Receiver *r, RingBuffer *rx, uint16_t budget) {
+	uint8_t b;
+	int16_t len;
+
+	if(!r->frameMode) {
+		if(RingBuffer_Peek(rx, 0, &b, 1) != 1)
+			return FRAME_READER_NONE;
+		CHECK(b == FRAME_DELIMITER);
+		RingBuffer_Consume(rx, 1);
+		r->frameMode = 1;
+	}
+	len = FrameReader_Poll(&r->reader, rx, budget);
+	if(len != FRAME_READER_NONE)
+		r->frameMode = 0;
+	return len;
+}
+
+static void testLoopback(void) {
+	static uint8_t storage[RING_SIZE];
+	uint8_t payload[FRAME_MAX_PAYLOAD], wire[FRAME_MAX_ENCODED];
+	RingBuffer rx;
+	Receiver r;
+	Frame sent, got;
+	uint16_t wireLen, pos, chunk;
+	uint32_t round;
+	int16_t len;
+
+	RingBuffer_Init(&rx, storage, RING_SIZE);
+	FrameReader_Init(&r.reader, r.buf, sizeof(r.buf));
+	r.frameMode = 0;
+
+	for(round = 0; round < ROUNDS; round++) {
+		sent.type = (uint8_t)rnd();
+		sent.id = (uint8_t)rnd();
+		sent.len = (uint16_t)(rnd() % (FRAME_MAX_PAYLOAD + 1));
+		sent.payload = payload;
+		fillRandom(payload, sent.len);
+		wireLen = Frame_Encode(&sent, wire);
+		CHECK(wireLen <= FRAME_MAX_ENCODED);
+		CHECK(wire[0] == FRAME_DELIMITER && wire[wireLen - 1] == FRAME_DELIMITER);
+
+		/* Uneven writes and small read budgets, so frames straddle the wrap and the polls */
+		pos = 0;
+		len = FRAME_READER_NONE;
+		while(len == FRAME_READER_NONE) {
+			chunk = (uint16_t)(1 + rnd() % 40);
+			if(chunk > wireLen - pos)
+				chunk = wireLen - pos;
+			pos += RingBuffer_WritePartial(&rx, wire + pos, chunk);
+			len = receive(&r, &rx, (uint16_t)(1 + rnd() % 64));
+			CHECK(len != FRAME_READER_NONE || pos < wireLen || RingBuffer_GetDataLength(&rx) > 0);
+		}
+		CHECK(pos == wireLen);
+		CHECK(len > 0);
+		CHECK(Frame_Decode(r.buf, (uint16_t)len, &got) == FRAME_OK);
+		CHECK(got.type == sent.type && got.id == sent.id && got.len == sent.len);
+		CHECK(memcmp(got.payload, payload, sent.len) == 0);
+		CHECK(RingBuffer_GetDataLength(&rx) == 0);
+	}
+}
+
+static void testCorruption(void) {
+	uint8_t payload[FRAME_MAX_PAYLOAD], wire[FRAME_MAX_ENCODED];
+	uint8_t raw[FRAME_MAX_RAW], enc[COBS_MAX_ENCODED(FRAME_MAX_RAW)];
+	Frame f, got;
+	uint16_t wireLen, rawLen, encLen, bit;
+	uint32_t round;
+
+	for(round = 0; round < ROUNDS / 4; round++) {
+		f.type = (uint8_t)rnd();
+		f.id = (uint8_t)rnd();
+		f.len = (uint16_t)(rnd() % (FRAME_MAX_PAYLOAD + 1));
+		f.payload = payload;
+		fillRandom(payload, f.len);
+		wireLen = Frame_Encode(&f, wire);
+
+		/* One flipped bit anywhere in the raw frame, re-stuffed so COBS is still valid */
+		rawLen = Cobs_Decode(wire + 1, wireLen - 2, raw);
+		CHECK(rawLen == FRAME_HEADER_SIZE + f.len + FRAME_CRC_SIZE);
+		bit = (uint16_t)(rnd() % (rawLen * 8));
+		raw[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+		encLen = Cobs_Encode(raw, rawLen, enc);
+		CHECK(Frame_Decode(enc, encLen, &got) == FRAME_BAD_CRC);
+
+		/* Too short to hold a header and a CRC */
+		encLen = Cobs_Encode(raw, (uint16_t)(1 + rnd() % (FRAME_HEADER_SIZE + FRAME_CRC_SIZE - 1)), enc);
+		CHECK(Frame_Decode(enc, encLen, &got) == FRAME_TOO_SHORT);
+	}
+}
+
+/* A frame longer than the reader's buffer is dropped whole; the next one still arrives */
+static void testTooLong(void) {
+	static uint8_t storage[RING_SIZE];
+	uint8_t payload[4] = { 1, 2, 3, 4 }, wire[FRAME_MAX_ENCODED];
+	uint8_t junk[64];
+	RingBuffer rx;
+	Receiver r;
+	Frame f = { FRAME_PING, 7, payload, sizeof(payload) }, got;
+	uint16_t wireLen, i;
+	int16_t len;
+
+	RingBuffer_Init(&rx, storage, RING_SIZE);
+	FrameReader_Init(&r.reader, r.buf, 16);
+	r.frameMode = 0;
+
+	memset(junk, 0x55, sizeof(junk));
+	junk[0] = FRAME_DELIMITER;
+	junk[sizeof(junk) - 1] = FRAME_DELIMITER;
+	wireLen = Frame_Encode(&f, wire);
+	CHECK(RingBuffer_Write(&rx, junk, sizeof(junk)) == RING_BUFFER_OK);
+	CHECK(RingBuffer_Write(&rx, wire, wireLen) == RING_BUFFER_OK);
+
+	for(i = 0; i < 100 && (len = receive(&r, &rx, 8)) == FRAME_READER_NONE; i++)
+		;
+	CHECK(len == FRAME_READER_TOO_LONG);
+	for(i = 0; i < 100 && (len = receive(&r, &rx, 8)) == FRAME_READER_NONE; i++)
+		;
+	CHECK(len > 0);
+	CHECK(Frame_Decode(r.buf, (uint16_t)len, &got) == FRAME_OK);
+	CHECK(got.type == FRAME_PING && got.id == 7 && got.len == sizeof(payload));
+}
+
+int main(int argc, char **argv) {
+	seed = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 0x5EED1234u;
+	rngState = seed ? seed : 1;
+
+	testCrc();
+	testCobs();
+	testLoopback();
+	testCorruption();
+	testTooLong();
+	printf("test_frame: seed %u: OK\n", seed);
+	return 0;
+}
@@ -0,0 +1,246 @@
+/*
+ * Tests for Src/linereader.c. Scripted cases pin down the editing rules:
+ * CR, LF and CR LF endings (a CR LF split across polls included),
+ * backspace and DEL at column 0, overlong lines, and a NUL opening a line
+ * being left in the ring for the frame parser. Then random keystrokes are
+ * fed through a small ring in uneven pieces and small budgets, and the
+ * lines and echo are compared with a byte-at-a-time reference.
+ *
+ *   ./test_linereader [seed]
+ */
+#include "linereader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUNDS    20000
+#define RING_SIZE 16
+#define LINE_SIZE 12
+
+static uint8_t storage[RING_SIZE];
+static RingBuffer rx;
+static LineReader lr;
+static char line[LINE_SIZE];
+static char echo[4096];
+static uint32_t echoLen;
+
+static uint32_t seed, rngState;
+
+#define CHECK(cond) do { \
+		if(!(cond)) { \
+			fprintf(stderr, "%s:%d: %s failed (seed %u)\n", __FILE__, __LINE__, #cond, seed); \
+			exit(1); \
+		} \
+	} while(0)
+
+static uint32_t rnd(void) {
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState;
+}
+
+static void echoCapture(const char *data, uint16_t len) {
+	CHECK(echoLen + len <= sizeof(echo));
+	memcpy(&echo[echoLen], data, len);
+	echoLen += len;
+}
+
+static void reset(void) {
+	RingBuffer_Init(&rx, storage, RING_SIZE);
+	LineReader_Init(&lr, line, LINE_SIZE, echoCapture);
+	echoLen = 0;
+}
+
+static void feed(const char *s) {
+	CHECK(RingBuffer_Write(&rx, (uint8_t *)s, (uint16_t)strlen(s)) == RING_BUFFER_OK);
+}
+
+/* Polls with a generous budget and checks the result, and the line for a completed one */
+static void expectLine(int16_t result, const char *text) {
+	CHECK(LineReader_Poll(&lr, &rx, 100) == result);
+	if(result >= 0)
+		CHECK(strcmp(lr.buf, text) == 0);
+}
+
+static void expectEcho(const char *text) {
+	CHECK(echoLen == strlen(text) && memcmp(echo, text, echoLen) == 0);
+	echoLen = 0;
+}
+
+static void testScripted(void) {
+	char *argv[4];
+	char words[] = "  led \t 1  2 3";
+
+	/* CR LF is one ending, even split across polls; LF CR is two */
+	reset();
+	feed("ab\r\ncd\r");
+	expectLine(2, "ab");
+	expectLine(2, "cd");
+	feed("\nef\n\r");
+	expectLine(2, "ef");
+	expectLine(0, "");
+	expectLine(LINE_READER_NONE, NULL);
+	expectEcho("ab\r\ncd\r\nef\r\n\r\n");
+
+	/* Backspace and DEL at column 0 do nothing and echo nothing */
+	reset();
+	feed("\b\x7f" "ab\bc\x7f\x7f\x7fx\r");
+	expectLine(1, "x");
+	expectEcho("ab\b \bc\b \b\b \bx\r\n");
+
+	/* Tabs become blanks, other control characters vanish */
+	reset();
+	feed("a\tb\x01\x1b" "c\r");
+	expectLine(4, "a bc");
+	expectEcho("a bc\r\n");
+
+	/* LINE_SIZE - 1 characters fit; one more drops the line up to its end */
+	reset();
+	feed("12345678901\r");
+	expectLine(11, "12345678901");
+	feed("123456789012");
+	expectLine(LINE_READER_NONE, NULL);
+	feed("3\rok\r");
+	expectLine(LINE_READER_TOO_LONG, NULL);
+	expectLine(2, "ok");
+
+	/* A NUL opening a line stays in the ring; inside a line it is ignored */
+	reset();
+	CHECK(RingBuffer_Write(&rx, (uint8_t *)"a\0b\r\0z", 6) == RING_BUFFER_OK);
+	expectLine(2, "ab");
+	expectLine(LINE_READER_NONE, NULL);
+	expectLine(LINE_READER_NONE, NULL);
+	CHECK(RingBuffer_GetDataLength(&rx) == 2);
+	expectEcho("ab\r\n");
+
+	/* The budget bounds what one poll consumes */
+	reset();
+	feed("abcdef\r");
+	CHECK(LineReader_Poll(&lr, &rx, 3) == LINE_READER_NONE);
+	CHECK(RingBuffer_GetDataLength(&rx) == 4);
+	expectLine(6, "abcdef");
+
+	CHECK(LineReader_Tokenize(words, argv, 4) == 4);
+	CHECK(strcmp(argv[0], "led") == 0 && strcmp(argv[1], "1") == 0);
+	CHECK(strcmp(argv[2], "2") == 0 && strcmp(argv[3], "3") == 0);
+	strcpy(words, "a b c d e");
+	CHECK(LineReader_Tokenize(words, argv, 2) == 2);
+	CHECK(strcmp(argv[0], "a") == 0 && strcmp(argv[1], "b") == 0);
+	strcpy(words, " \t ");
+	CHECK(LineReader_Tokenize(words, argv, 4) == 0);
+}
+
+/* Reference: the editing rules applied one byte at a time */
+typedef struct {
+	char buf[LINE_SIZE];
+	uint16_t len;
+	uint8_t discard;
+	char lastEol;
+	char echo[4096];
+	uint32_t echoLen;
+} Model;
+
+static void modelEcho(Model *m, const char *s, uint16_t n) {
+	memcpy(&m->echo[m->echoLen], s, n);
+	m->echoLen += n;
+}
+
+/* Returns LINE_READER_NONE or what LineReader_Poll reports for the line this byte ends */
+static int16_t modelByte(Model *m, char c) {
+	int16_t result;
+
+	if(c == '\r' || c == '\n') {
+		if(c == '\n' && m->lastEol == '\r') {
+			m->lastEol = 0;
+			return LINE_READER_NONE;
+		}
+		m->lastEol = c;
+		modelEcho(m, "\r\n", 2);
+		result = m->discard ? LINE_READER_TOO_LONG : (int16_t)m->len;
+		m->buf[m->len] = '\0';
+		m->len = 0;
+		m->discard = 0;
+		return result;
+	}
+	m->lastEol = 0;
+	if(c == '\t')
+		c = ' ';
+	if(c == '\b' || c == 0x7F) {
+		if(m->len > 0) {
+			m->len--;
+			modelEcho(m, "\b \b", 3);
+		}
+	} else if((uint8_t)c >= ' ') {
+		if(m->len + 1 < LINE_SIZE) {
+			m->buf[m->len++] = c;
+			modelEcho(m, &c, 1);
+		} else {
+			m->discard = 1;
+		}
+	}
+	return LINE_READER_NONE;
+}
+
+static char rndKey(void) {
+	static const char special[] = { '\r', '\n', '\b', 0x7F, '\t', 0x03, 0x1B };
+	uint32_t r = rnd() % 16;
+
+	if(r < sizeof(special))
+		return special[r];
+	return (char)(' ' + rnd() % 95);
+}
+
+static void testRandom(void) {
+	static Model m;
+	char input[64];
+	uint16_t inputLen, pos, chunk, i;
+	int16_t want, got;
+	uint32_t round, lines = 0;
+
+	reset();
+	memset(&m, 0, sizeof(m));
+	for(round = 0; round < ROUNDS; round++) {
+		inputLen = (uint16_t)(1 + rnd() % sizeof(input));
+		for(i = 0; i < inputLen; i++)
+			input[i] = rndKey();
+
+		/* Uneven writes into a ring smaller than the input, small budgets */
+		pos = 0;
+		i = 0;
+		while(i < inputLen) {
+			chunk = (uint16_t)(1 + rnd() % 8);
+			if(chunk > inputLen - pos)
+				chunk = inputLen - pos;
+			pos += RingBuffer_WritePartial(&rx, (uint8_t *)input + pos, chunk);
+			got = LineReader_Poll(&lr, &rx, (uint16_t)(1 + rnd() % 6));
+
+			/* The reference takes the bytes the reader consumed; only the last may end a line */
+			want = LINE_READER_NONE;
+			while(i < pos - RingBuffer_GetDataLength(&rx)) {
+				CHECK(want == LINE_READER_NONE);
+				want = modelByte(&m, input[i++]);
+			}
+			CHECK(got == want);
+			if(got >= 0) {
+				CHECK(strcmp(lr.buf, m.buf) == 0);
+				lines++;
+			}
+		}
+
+		CHECK(echoLen == m.echoLen && memcmp(echo, m.echo, echoLen) == 0);
+		echoLen = 0;
+		m.echoLen = 0;
+	}
+	CHECK(lines > ROUNDS);
+}
+
+int main(int argc, char **argv) {
+	seed = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 0x5EED1234u;
+	rngState = seed ? seed : 1;
+
+	testScripted();
+	testRandom();
+	printf("test_linereader: seed %u: OK\n", seed);
+	return 0;
+}
@@ -0,0 +1,205 @@
+/*
+ * Property tests for Src/msgqueue.c. Random pushes and pops are checked
+ * against a reference model of whole records, including an empty queue,
+ * records that exactly fill it, ones that do not fit and truncating pops.
+ * Then a producer thread stands in for an ISR and pushes sequenced records
+ * while the main thread pops them: every record must arrive whole, intact
+ * and in order.
+ *
+ *   ./test_msgqueue [seed]
+ */
+#include "msgqueue.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_OPS        200000
+/* The most records the largest queue can hold: one payload byte each */
+#define MODEL_RECORDS  (RING_BUFFER_MAX_LENGTH / (MSG_QUEUE_HEADER_SIZE + 1) + 1)
+#define THREAD_RECORDS 200000
+
+static uint8_t storage[RING_BUFFER_MAX_LENGTH];
+static uint8_t data[RING_BUFFER_MAX_LENGTH];
+static uint8_t out[RING_BUFFER_MAX_LENGTH];
+
+/* Reference model: record lengths in a FIFO, payload bytes in another */
+static uint16_t modelLen[MODEL_RECORDS];
+static uint32_t modelFirst, modelCount;
+static uint8_t modelBytes[RING_BUFFER_MAX_LENGTH];
+static uint32_t bytesHead, bytesLen, modelSize;
+
+static uint32_t seed, rngState;
+static uint32_t opCount;
+
+#define CHECK(cond) do { \
+		if(!(cond)) { \
+			fprintf(stderr, "%s:%d: %s failed (seed %u, size %u, op %u)\n", \
+					__FILE__, __LINE__, #cond, seed, modelSize, opCount); \
+			exit(1); \
+		} \
+	} while(0)
+
+static uint32_t rnd(void) {
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState;
+}
+
+/* Lengths biased towards the edges: empty, one byte, exactly the free space, one past it */
+static uint16_t rndLen(uint32_t freeSpace) {
+	uint32_t fits = freeSpace > MSG_QUEUE_HEADER_SIZE ? freeSpace - MSG_QUEUE_HEADER_SIZE : 0;
+
+	switch(rnd() % 6) {
+	case 0:
+		return 0;
+	case 1:
+		return 1;
+	case 2:
+		return (uint16_t)fits;
+	case 3:
+		return (uint16_t)(fits + 1);
+	default:
+		return (uint16_t)(rnd() % (modelSize / 4 + 1));
+	}
+}
+
+static uint32_t modelUsed(void) {
+	return bytesLen + modelCount * MSG_QUEUE_HEADER_SIZE;
+}
+
+static void stepModel(MsgQueue *q) {
+	uint32_t freeSpace = modelSize - modelUsed();
+	uint16_t len, maxLen, got, i;
+	uint8_t status;
+
+	if(rnd() % 2 == 0) {
+		len = rndLen(freeSpace);
+		for(i = 0; i < len; i++)
+			data[i] = (uint8_t)rnd();
+		status = MsgQueue_Push(q, data, len);
+		if(len == 0) {
+			CHECK(status == RING_BUFFER_NO_SUFFICIENT_SPACE);
+		} else if((uint32_t)len + MSG_QUEUE_HEADER_SIZE > freeSpace) {
+			CHECK(status == (freeSpace == 0 ? RING_BUFFER_FULL : RING_BUFFER_NO_SUFFICIENT_SPACE));
+		} else {
+			CHECK(status == RING_BUFFER_OK);
+			modelLen[(modelFirst + modelCount++) % MODEL_RECORDS] = len;
+			for(i = 0; i < len; i++)
+				modelBytes[(bytesHead + bytesLen++) % modelSize] = data[i];
+		}
+	} else {
+		/* Sometimes too small a buffer: the record is truncated but still removed whole */
+		maxLen = rnd() % 4 == 0 ? (uint16_t)(rnd() % 8) : (uint16_t)sizeof(out);
+		got = MsgQueue_Pop(q, out, maxLen);
+		if(modelCount == 0) {
+			CHECK(got == 0);
+			return;
+		}
+		len = modelLen[modelFirst];
+		CHECK(got == (len < maxLen ? len : maxLen));
+		for(i = 0; i < got; i++)
+			CHECK(out[i] == modelBytes[(bytesHead + i) % modelSize]);
+		bytesHead = (bytesHead + len) % modelSize;
+		bytesLen -= len;
+		modelFirst = (modelFirst + 1) % MODEL_RECORDS;
+		modelCount--;
+	}
+
+	CHECK(MsgQueue_IsEmpty(q) == (modelCount == 0));
+	CHECK(MsgQueue_NextLength(q) == (modelCount ? modelLen[modelFirst] : 0));
+	CHECK(RingBuffer_GetDataLength(&q->ring) == modelUsed());
+}
+
+static void runModel(uint16_t size) {
+	MsgQueue q;
+
+	MsgQueue_Init(&q, storage, size);
+	modelFirst = modelCount = 0;
+	bytesHead = bytesLen = 0;
+	modelSize = size;
+
+	/* Empty queue, then one record that takes every byte */
+	CHECK(MsgQueue_IsEmpty(&q) && MsgQueue_NextLength(&q) == 0);
+	CHECK(MsgQueue_Pop(&q, out, sizeof(out)) == 0);
+	if(size > MSG_QUEUE_HEADER_SIZE) {
+		memset(data, 0xA5, size);
+		CHECK(MsgQueue_Push(&q, data, size - MSG_QUEUE_HEADER_SIZE + 1) == RING_BUFFER_NO_SUFFICIENT_SPACE);
+		CHECK(MsgQueue_Push(&q, data, size - MSG_QUEUE_HEADER_SIZE) == RING_BUFFER_OK);
+		CHECK(MsgQueue_Push(&q, data, 1) == RING_BUFFER_FULL);
+		CHECK(MsgQueue_Pop(&q, out, sizeof(out)) == size - MSG_QUEUE_HEADER_SIZE);
+		CHECK(memcmp(out, data, size - MSG_QUEUE_HEADER_SIZE) == 0);
+		CHECK(MsgQueue_IsEmpty(&q));
+	}
+
+	for(opCount = 0; opCount < MAX_OPS; opCount++)
+		stepModel(&q);
+}
+
+/* ISR-style producer: pushes sequenced records, retrying while the queue is full */
+static MsgQueue shared;
+
+static uint8_t recordByte(uint32_t seq, uint16_t i) {
+	return (uint8_t)(seq * 31 + i);
+}
+
+static void *produce(void *arg) {
+	uint8_t record[4 + 64];
+	uint32_t seq, rng = 0x9E3779B9u;
+	uint16_t len, i;
+
+	(void)arg;
+	for(seq = 0; seq < THREAD_RECORDS; seq++) {
+		rng = rng * 1664525u + 1013904223u;
+		len = (uint16_t)(4 + (rng >> 24) % 65);
+		memcpy(record, &seq, 4);
+		for(i = 4; i < len; i++)
+			record[i] = recordByte(seq, i);
+		while(MsgQueue_Push(&shared, record, len) != RING_BUFFER_OK)
+			sched_yield();
+	}
+	return NULL;
+}
+
+static void runThreaded(void) {
+	pthread_t producer;
+	uint8_t record[4 + 64];
+	uint32_t seq, expected = 0;
+	uint16_t len, i;
+
+	MsgQueue_Init(&shared, storage, 256);
+	CHECK(pthread_create(&producer, NULL, produce, NULL) == 0);
+	while(expected < THREAD_RECORDS) {
+		len = MsgQueue_Pop(&shared, record, sizeof(record));
+		if(len == 0) {
+			sched_yield();
+			continue;
+		}
+		CHECK(len >= 4);
+		memcpy(&seq, record, 4);
+		CHECK(seq == expected);
+		for(i = 4; i < len; i++)
+			CHECK(record[i] == recordByte(seq, i));
+		expected++;
+	}
+	pthread_join(producer, NULL);
+	CHECK(MsgQueue_IsEmpty(&shared));
+}
+
+int main(int argc, char **argv) {
+	static const uint16_t sizes[] = { 2, 4, 64, 1024, 32768 };
+	uint32_t i;
+
+	seed = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 0x5EED1234u;
+	rngState = seed ? seed : 1;
+
+	for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if(sizes[i] <= RING_BUFFER_MAX_LENGTH)
+			runModel(sizes[i]);
+	}
+	runThreaded();
+	printf("test_msgqueue: seed %u, %u threaded records: OK\n", seed, THREAD_RECORDS);
+	return 0;
+}
@@ -0,0 +1,334 @@
+/*
+ * Randomized property tests for Src/ringbuffer.c against a reference model.
+ * Every operation is applied to both, then contents, GetDataLength,
+ * GetFreeSpace and the statistics are compared. Each capacity runs until
+ * the free-running indices have wrapped several times.
+ *
+ *   ./test_ringbuffer [seed]
+ */
+#include "ringbuffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INDEX_RANGE ((uint32_t)(RingBuffer_Index)~0 + 1)
+#define MP_MAX_FILL (INDEX_RANGE / 2 - 1)
+#define MAX_OPS     2000000
+
+static uint8_t storage[RING_BUFFER_MAX_LENGTH];
+static uint8_t data[RING_BUFFER_MAX_LENGTH + 8];
+static uint8_t out[RING_BUFFER_MAX_LENGTH + 8];
+
+/* Reference model: a plain queue with head and length */
+static uint8_t model[RING_BUFFER_MAX_LENGTH];
+static uint32_t modelHead, modelLen, modelSize;
+
+static uint32_t seed, rngState;
+static uint32_t opCount;
+static const char *opName;
+
+#define CHECK(cond) do { \
+		if(!(cond)) { \
+			fprintf(stderr, "%s:%d: %s failed (seed %u, size %u, op %u %s)\n", \
+					__FILE__, __LINE__, #cond, seed, modelSize, opCount, opName); \
+			exit(1); \
+		} \
+	} while(0)
+
+static uint32_t rnd(void) {
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState;
+}
+
+/* Lengths biased towards the edges: 0, 1, exactly full, one past full */
+static uint16_t rndLen(uint32_t limit) {
+	switch(rnd() % 8) {
+	case 0:
+		return 0;
+	case 1:
+		return 1;
+	case 2:
+		return (uint16_t)limit;
+	case 3:
+		return (uint16_t)(limit + 1);
+	default:
+		return (uint16_t)(rnd() % (limit + 2));
+	}
+}
+
+static void fillData(uint16_t len) {
+	uint16_t i;
+
+	for(i = 0; i < len; i++)
+		data[i] = (uint8_t)rnd();
+}
+
+static void modelPush(const uint8_t *p, uint32_t len) {
+	uint32_t i;
+
+	for(i = 0; i < len; i++)
+		model[(modelHead + modelLen++) % modelSize] = p[i];
+}
+
+static void modelCheckFront(const uint8_t *p, uint32_t offset, uint32_t len) {
+	uint32_t i;
+
+	for(i = 0; i < len; i++)
+		CHECK(p[i] == model[(modelHead + offset + i) % modelSize]);
+}
+
+static void modelPop(uint32_t len) {
+	modelHead = (modelHead + len) % modelSize;
+	modelLen -= len;
+}
+
+static void checkInvariants(RingBuffer *rb) {
+	RingBuffer_Stats stats;
+
+	CHECK(RingBuffer_GetDataLength(rb) == modelLen);
+	CHECK(RingBuffer_GetFreeSpace(rb) == modelSize - modelLen);
+	RingBuffer_GetStats(rb, &stats);
+	CHECK(stats.highWater >= modelLen && stats.highWater <= modelSize);
+}
+
+/* Single-producer operations, mixed freely */
+static void stepSPSC(RingBuffer *rb) {
+	uint32_t freeSpace = modelSize - modelLen;
+	uint16_t len, offset, got;
+	uint8_t *region, byte, status;
+
+	switch(rnd() % 11) {
+	case 0:
+		opName = "Write";
+		len = rndLen(modelSize);
+		fillData(len);
+		status = RingBuffer_Write(rb, data, len);
+		if(freeSpace == 0) {
+			CHECK(status == RING_BUFFER_FULL);
+		} else if(len > freeSpace) {
+			CHECK(status == RING_BUFFER_NO_SUFFICIENT_SPACE);
+		} else {
+			CHECK(status == RING_BUFFER_OK);
+			modelPush(data, len);
+		}
+		break;
+	case 1:
+		opName = "WritePartial";
+		len = rndLen(modelSize);
+		fillData(len);
+		got = RingBuffer_WritePartial(rb, data, len);
+		CHECK(got == (len < freeSpace ? len : freeSpace));
+		modelPush(data, got);
+		break;
+	case 2:
+	case 3:
+		opName = "Read";
+		len = rndLen(modelSize);
+		got = RingBuffer_Read(rb, out, len);
+		CHECK(got == (len < modelLen ? len : modelLen));
+		modelCheckFront(out, 0, got);
+		modelPop(got);
+		break;
+	case 4:
+		opName = "PutByte";
+		byte = (uint8_t)rnd();
+		got = RingBuffer_PutByte(rb, byte);
+		CHECK(got == (freeSpace > 0));
+		if(got)
+			modelPush(&byte, 1);
+		break;
+	case 5:
+		opName = "GetByte";
+		got = RingBuffer_GetByte(rb, &byte);
+		CHECK(got == (modelLen > 0));
+		if(got) {
+			modelCheckFront(&byte, 0, 1);
+			modelPop(1);
+		}
+		break;
+	case 6: {
+		uint32_t keep;
+
+		opName = "Overwrite";
+		len = rndLen(modelSize);
+		fillData(len);
+		got = RingBuffer_Overwrite(rb, data, len);
+		keep = len > modelSize ? modelSize : len;
+		CHECK(got == (keep > freeSpace ? keep - freeSpace : 0));
+		modelPop(got);
+		modelPush(data + len - keep, keep);
+		break;
+	}
+	case 7:
+		opName = "Peek";
+		offset = (uint16_t)(rnd() % (modelSize + 1));
+		len = rndLen(modelSize);
+		got = RingBuffer_Peek(rb, offset, out, len);
+		if(offset >= modelLen)
+			CHECK(got == 0);
+		else
+			CHECK(got == (len < modelLen - offset ? len : modelLen - offset));
+		modelCheckFront(out, offset, got);
+		break;
+	case 8:
+		opName = "ReadRegion";
+		got = RingBuffer_GetReadRegion(rb, &region);
+		/* Contiguous up to the end of storage, never more than stored */
+		CHECK(got <= modelLen);
+		CHECK(region + got <= storage + modelSize);
+		CHECK(got == modelLen || region + got == storage + modelSize);
+		modelCheckFront(region, 0, got);
+		len = got ? (uint16_t)(rnd() % (got + 1)) : 0;
+		RingBuffer_Consume(rb, len);
+		modelPop(len);
+		break;
+	case 9:
+		opName = "WriteRegion";
+		got = RingBuffer_GetWriteRegion(rb, &region);
+		CHECK(got <= freeSpace);
+		CHECK(region + got <= storage + modelSize);
+		CHECK(got == freeSpace || region + got == storage + modelSize);
+		len = got ? (uint16_t)(rnd() % (got + 1)) : 0;
+		fillData(len);
+		memcpy(region, data, len);
+		RingBuffer_Commit(rb, len);
+		modelPush(data, len);
+		break;
+	default:
+		/* Two pieces staged out of order, published together */
+		opName = "Stage";
+		len = freeSpace ? (uint16_t)(rnd() % (freeSpace + 1)) : 0;
+		offset = len ? (uint16_t)(rnd() % (len + 1)) : 0;
+		fillData(len);
+		RingBuffer_Stage(rb, offset, data + offset, len - offset);
+		RingBuffer_Stage(rb, 0, data, offset);
+		RingBuffer_Commit(rb, len);
+		modelPush(data, len);
+		break;
+	}
+}
+
+/* Multi-producer writers, used alone from one thread; they stop short of half the index range */
+static void stepMP(RingBuffer *rb) {
+	uint32_t capacity = modelSize < MP_MAX_FILL ? modelSize : MP_MAX_FILL;
+	uint32_t freeSpace = modelLen < capacity ? capacity - modelLen : 0;
+	uint16_t len, got;
+	uint8_t status;
+
+	switch(rnd() % 3) {
+	case 0:
+		opName = "WriteMP";
+		len = rndLen(modelSize);
+		fillData(len);
+		status = RingBuffer_WriteMP(rb, data, len);
+		if(len <= freeSpace) {
+			CHECK(status == RING_BUFFER_OK);
+			modelPush(data, len);
+		} else {
+			CHECK(status == (freeSpace == 0 ? RING_BUFFER_FULL : RING_BUFFER_NO_SUFFICIENT_SPACE));
+		}
+		break;
+	case 1:
+		opName = "WritePartialMP";
+		len = rndLen(modelSize);
+		fillData(len);
+		got = RingBuffer_WritePartialMP(rb, data, len);
+		CHECK(got == (len < freeSpace ? len : freeSpace));
+		modelPush(data, got);
+		break;
+	default:
+		opName = "Read";
+		len = rndLen(modelSize);
+		got = RingBuffer_Read(rb, out, len);
+		CHECK(got == (len < modelLen ? len : modelLen));
+		modelCheckFront(out, 0, got);
+		modelPop(got);
+		break;
+	}
+}
+
+/*
+ * Runs until four index wraps' worth of data has been written, so
+ * every head/tail combination near the wrap is visited.
+ */
+static void run(uint16_t size, uint8_t mp) {
+	RingBuffer rb;
+	RingBuffer_Stats stats;
+	uint32_t moved = 0, before;
+
+	RingBuffer_Init(&rb, storage, size);
+	modelHead = modelLen = 0;
+	modelSize = size;
+
+	for(opCount = 0; opCount < MAX_OPS && moved < 4 * INDEX_RANGE; opCount++) {
+		RingBuffer_GetStats(&rb, &stats);
+		before = stats.bytesWritten;
+		if(mp)
+			stepMP(&rb);
+		else
+			stepSPSC(&rb);
+		checkInvariants(&rb);
+		RingBuffer_GetStats(&rb, &stats);
+		moved += stats.bytesWritten - before;
+	}
+	CHECK(moved >= 4 * INDEX_RANGE);
+}
+
+/*
+ * RingBuffer_Resume: garbage metadata is a plain init; metadata that still
+ * fits the storage keeps head and the bytes before it, and starts empty.
+ */
+static void testResume(void) {
+	static uint8_t sent[1024];
+	RingBuffer rb;
+	RingBuffer_Index head;
+	uint16_t size = 64, total = 0, i;
+
+	opName = "Resume";
+	modelSize = size;
+	memset(&rb, 0xA5, sizeof(rb));
+	CHECK(RingBuffer_Resume(&rb, storage, size) == 0);
+	CHECK(rb.head == 0 && RingBuffer_GetDataLength(&rb) == 0);
+
+	/* Wrap a few times and leave some of it unread, as a crash would */
+	for(i = 0; i < 20; i++) {
+		fillData(40);
+		memcpy(&sent[total], data, 40);
+		total += 40;
+		CHECK(RingBuffer_Write(&rb, data, 40) == RING_BUFFER_OK);
+		CHECK(RingBuffer_Read(&rb, out, i == 19 ? 10 : 40) == (i == 19 ? 10 : 40));
+	}
+	head = rb.head;
+	CHECK(RingBuffer_Resume(&rb, storage, size) == 1);
+	CHECK(rb.head == head && RingBuffer_GetDataLength(&rb) == 0 && RingBuffer_GetFreeSpace(&rb) == size);
+	for(i = 0; i < size; i++)
+		CHECK(storage[(RingBuffer_Index)(head - size + i) & rb.mask] == sent[total - size + i]);
+
+	/* New output, multi-producer included, follows the old */
+	fillData(5);
+	CHECK(RingBuffer_WriteMP(&rb, data, 5) == RING_BUFFER_OK);
+	CHECK(RingBuffer_Read(&rb, out, sizeof(out)) == 5 && memcmp(out, data, 5) == 0);
+	CHECK(storage[head & rb.mask] == data[0]);
+
+	/* Metadata for other storage or another size is not trusted */
+	CHECK(RingBuffer_Resume(&rb, storage, size / 2) == 0);
+	CHECK(rb.head == 0 && rb.size == size / 2);
+}
+
+int main(int argc, char **argv) {
+	uint32_t size;
+
+	seed = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 0x5EED1234u;
+	rngState = seed ? seed : 1;
+
+	testResume();
+	for(size = 1; size <= RING_BUFFER_MAX_LENGTH; size <<= 1) {
+		run((uint16_t)size, 0);
+		run((uint16_t)size, 1);
+	}
+	printf("test_ringbuffer: sizes 1..%u, %u-bit indices, seed %u: OK\n",
+			RING_BUFFER_MAX_LENGTH, (unsigned)(8 * sizeof(RingBuffer_Index)), seed);
+	return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * Multi-producer stress test: producer threads write through
+ * RingBuffer_WriteMP / RingBuffer_WritePartialMP while one consumer thread
+ * reads, with no locks anywhere.
+ *
+ * Phase 1 sends sequenced messages with WriteMP, retrying when rejected.
+ * Each message must become visible whole, arrive intact, and arrive in
+ * order per producer. Phase 2 sends runs of WritePartialMP bytes tagged
+ * with the producer; every granted byte must reach the consumer.
+ *
+ *   ./test_ringbuffer_mp [messages per producer]
+ */
+#include "ringbuffer.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PRODUCERS   4
+#define HEADER_SIZE 6   /* u8 producer, u8 payload length, u32 sequence */
+
+static uint8_t storage[RING_BUFFER_MAX_LENGTH];
+static RingBuffer rb;
+static uint32_t messages = 50000;
+static uint8_t maxPayload;
+static volatile int producersLeft;
+static uint64_t granted[PRODUCERS];
+static uint64_t received[PRODUCERS];
+
+/* Built with -DRING_BUFFER_MP_HOOK=mpHook: yield inside the writers' races now and then */
+void mpHook(void) {
+	static __thread uint32_t rng = 1;
+
+	rng = rng * 1664525u + 1013904223u;
+	if((rng >> 28) == 0)
+		sched_yield();
+}
+
+#define CHECK(cond) do { \
+		if(!(cond)) { \
+			fprintf(stderr, "%s:%d: %s failed (size %u)\n", __FILE__, __LINE__, #cond, rb.size); \
+			exit(1); \
+		} \
+	} while(0)
+
+static uint8_t payloadByte(uint32_t seq, uint8_t i, uint8_t id) {
+	return (uint8_t)(seq * 7 + i * 13 + id);
+}
+
+static void *produceMessages(void *arg) {
+	uint8_t id = (uint8_t)(uintptr_t)arg;
+	uint8_t msg[HEADER_SIZE + 255];
+	uint32_t seq, rng = 0x9E3779B9u * (id + 1);
+	uint8_t len, i;
+
+	for(seq = 0; seq < messages; seq++) {
+		rng = rng * 1664525u + 1013904223u;
+		len = (uint8_t)((rng >> 24) % (maxPayload + 1));
+		msg[0] = id;
+		msg[1] = len;
+		memcpy(&msg[2], &seq, 4);
+		for(i = 0; i < len; i++)
+			msg[HEADER_SIZE + i] = payloadByte(seq, i, id);
+		while(RingBuffer_WriteMP(&rb, msg, HEADER_SIZE + len) != RING_BUFFER_OK)
+			sched_yield();
+	}
+	__atomic_sub_fetch(&producersLeft, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void *consumeMessages(void *arg) {
+	uint8_t msg[HEADER_SIZE + 255];
+	uint32_t expected[PRODUCERS] = { 0 };
+	uint32_t seq, total = 0;
+	uint8_t i;
+
+	(void)arg;
+	while(total < PRODUCERS * messages) {
+		if(RingBuffer_Peek(&rb, 0, msg, HEADER_SIZE) < HEADER_SIZE) {
+			sched_yield();
+			continue;
+		}
+		/* head only moves once every overlapping writer is done: the whole message is there */
+		CHECK(RingBuffer_GetDataLength(&rb) >= (uint16_t)(HEADER_SIZE + msg[1]));
+		CHECK(RingBuffer_Read(&rb, msg, HEADER_SIZE + msg[1]) == HEADER_SIZE + msg[1]);
+
+		CHECK(msg[0] < PRODUCERS);
+		memcpy(&seq, &msg[2], 4);
+		CHECK(seq == expected[msg[0]]);
+		for(i = 0; i < msg[1]; i++)
+			CHECK(msg[HEADER_SIZE + i] == payloadByte(seq, i, msg[0]));
+		expected[msg[0]]++;
+		total++;
+	}
+	return NULL;
+}
+
+static void *producePartial(void *arg) {
+	uint8_t id = (uint8_t)(uintptr_t)arg;
+	uint8_t run[255];
+	uint32_t n, rng = 0x85EBCA6Bu * (id + 1);
+	uint16_t len;
+
+	memset(run, id, sizeof(run));
+	for(n = 0; n < messages; n++) {
+		rng = rng * 1664525u + 1013904223u;
+		len = (uint16_t)(1 + (rng >> 24) % maxPayload);
+		granted[id] += RingBuffer_WritePartialMP(&rb, run, len);
+	}
+	__atomic_sub_fetch(&producersLeft, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void *consumePartial(void *arg) {
+	uint8_t chunk[256];
+	uint16_t got, i;
+
+	(void)arg;
+	while(1) {
+		/* Sample the producers before reading, so nothing is left behind once they are all done */
+		int left = __atomic_load_n(&producersLeft, __ATOMIC_ACQUIRE);
+
+		got = RingBuffer_Read(&rb, chunk, sizeof(chunk));
+		for(i = 0; i < got; i++) {
+			CHECK(chunk[i] < PRODUCERS);
+			received[chunk[i]]++;
+		}
+		if(got == 0 && left == 0)
+			break;
+	}
+	return NULL;
+}
+
+static void runPhase(void *(*producer)(void *), void *(*consumer)(void *)) {
+	pthread_t threads[PRODUCERS + 1];
+	uintptr_t i;
+
+	producersLeft = PRODUCERS;
+	CHECK(pthread_create(&threads[PRODUCERS], NULL, consumer, NULL) == 0);
+	for(i = 0; i < PRODUCERS; i++)
+		CHECK(pthread_create(&threads[i], NULL, producer, (void *)i) == 0);
+	for(i = 0; i <= PRODUCERS; i++)
+		pthread_join(threads[i], NULL);
+	CHECK(RingBuffer_GetDataLength(&rb) == 0);
+}
+
+static void run(uint16_t size) {
+	uint32_t i;
+
+	RingBuffer_Init(&rb, storage, size);
+	/* A message must fit the buffer, and the multi-producer fill limit of 127 with 8-bit indices */
+	maxPayload = (uint8_t)((size < 128 ? size : 127) - HEADER_SIZE);
+	if(maxPayload > 200)
+		maxPayload = 200;
+	runPhase(produceMessages, consumeMessages);
+
+	RingBuffer_Init(&rb, storage, size);
+	memset(granted, 0, sizeof(granted));
+	memset(received, 0, sizeof(received));
+	runPhase(producePartial, consumePartial);
+	for(i = 0; i < PRODUCERS; i++)
+		CHECK(received[i] == granted[i]);
+}
+
+int main(int argc, char **argv) {
+	static const uint16_t sizes[] = { 16, 64, 128, 1024, 32768 };
+	uint32_t i;
+
+	if(argc > 1)
+		messages = (uint32_t)strtoul(argv[1], NULL, 0);
+
+	for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if(sizes[i] <= RING_BUFFER_MAX_LENGTH)
+			run(sizes[i]);
+	}
+	printf("test_ringbuffer_mp: %d producers x %u messages, %u-bit indices: OK\n",
+			PRODUCERS, messages, (unsigned)(8 * sizeof(RingBuffer_Index)));
+	return 0;
+}
@@ -0,0 +1,178 @@
+/*
+ * Tests for the baud rate helpers of Src/uart_port.c, built against
+ * stub/stm32f1xx_hal.h, whose BRR macros are the HAL's own. For the bus
+ * clocks SystemClock_Config can produce, and USART1 on APB2 against the
+ * others on APB1, it checks the range limits, that SetBaud, CheckBaud and
+ * GetBaud agree on the rate BRR yields, that BRR is the nearest divider
+ * and fits its 16 bits, and that a rejected rate leaves the USART alone.
+ *
+ *   ./test_uart_baud [seed]
+ */
+#include "uart_port.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUNDS 100000
+
+USART_TypeDef Sim_USART1;
+static USART_TypeDef usart2;
+static UART_HandleTypeDef huart;
+static UART_Port port;
+static uint32_t pclk1, pclk2;
+
+static uint32_t seed, rngState;
+
+#define CHECK(cond) do { \
+		if(!(cond)) { \
+			fprintf(stderr, "%s:%d: %s failed (seed %u, pclk1 %u, pclk2 %u)\n", \
+					__FILE__, __LINE__, #cond, seed, pclk1, pclk2); \
+			exit(1); \
+		} \
+	} while(0)
+
+static uint32_t rnd(void) {
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState;
+}
+
+uint32_t HAL_GetTick(void) {
+	return 0;
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void) {
+	return pclk1;
+}
+
+uint32_t HAL_RCC_GetPCLK2Freq(void) {
+	return pclk2;
+}
+
+/* Nothing here transfers data */
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *h, uint8_t *data, uint16_t size) {
+	(void)h;
+	(void)data;
+	(void)size;
+	return HAL_ERROR;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef *h, uint8_t *data, uint16_t size) {
+	(void)h;
+	(void)data;
+	(void)size;
+	return HAL_ERROR;
+}
+
+HAL_StatusTypeDef HAL_UART_AbortTransmit(UART_HandleTypeDef *h) {
+	(void)h;
+	return HAL_OK;
+}
+
+void HAL_UART_IRQHandler(UART_HandleTypeDef *h) {
+	(void)h;
+}
+
+/* The USART as MX_USARTx_UART_Init leaves it: enabled, interrupts on, some rate set */
+static void attach(USART_TypeDef *usart) {
+	memset(usart, 0, sizeof(*usart));
+	usart->CR1 = USART_CR1_UE | USART_CR1_RXNEIE | USART_CR1_IDLEIE;
+	usart->BRR = 0x271;
+	memset(&huart, 0, sizeof(huart));
+	huart.Instance = usart;
+	huart.Init.BaudRate = 115200;
+	memset(&port, 0, sizeof(port));
+	port.huart = &huart;
+}
+
+/* A rate spread evenly over the decades between lo and hi */
+static uint32_t rndRate(uint32_t lo, uint32_t hi) {
+	uint32_t decade = lo;
+
+	while(decade * 10 <= hi && rnd() % 2)
+		decade *= 10;
+	hi = hi < decade * 10 ? hi : decade * 10;
+	return decade + rnd() % (hi - decade + 1);
+}
+
+static void checkRate(uint32_t pclk, uint32_t baud) {
+	uint32_t before = port.huart->Instance->BRR;
+	uint32_t rate = UART_Port_CheckBaud(&port, baud);
+	uint32_t brr, got;
+
+	if(baud == 0 || baud > pclk / 16 || pclk / baud >= 0xFFFF) {
+		CHECK(rate == 0);
+		CHECK(UART_Port_SetBaud(&port, baud) == 0);
+		CHECK(port.huart->Instance->BRR == before);
+		return;
+	}
+
+	got = UART_Port_SetBaud(&port, baud);
+	brr = port.huart->Instance->BRR;
+	CHECK(rate != 0 && got == rate);
+	CHECK(UART_Port_GetBaud(&port) == rate);
+	CHECK(rate == pclk / brr);
+	CHECK(port.huart->Init.BaudRate == baud);
+	CHECK(port.huart->Instance->CR1 == (USART_CR1_UE | USART_CR1_RXNEIE | USART_CR1_IDLEIE));
+
+	/*
+	 * BRR is USARTDIV * 16 in 16 bits, ideally pclk / baud. The HAL cuts
+	 * USARTDIV to 1/100 before rounding the fraction to 1/16, so BRR may
+	 * fall short of the ideal by up to 0.66 but never exceed it by over 0.5.
+	 */
+	CHECK(brr >= 16 && brr <= 0xFFFF);
+	CHECK((uint64_t)brr * baud + baud >= pclk);
+	CHECK((uint64_t)brr * baud * 2 <= (uint64_t)pclk * 2 + baud);
+}
+
+static void testClocks(uint32_t apb1, uint32_t apb2) {
+	static const uint32_t standard[] = { 1200, 2400, 9600, 19200, 38400, 57600, 115200,
+			230400, 460800, 921600, 1000000, 2000000, 2250000, 4500000 };
+	USART_TypeDef *instances[2] = { USART1, &usart2 };
+	uint32_t pclk, low, round, i, k;
+
+	pclk1 = apb1;
+	pclk2 = apb2;
+	for(k = 0; k < 2; k++) {
+		attach(instances[k]);
+		pclk = k == 0 ? pclk2 : pclk1;
+		CHECK(UART_Port_MaxBaud(&port) == pclk / 16);
+
+		/* The edges: nothing, the fastest rate, one past it, and the slowest BRR allows */
+		low = pclk / 0xFFFF + 1;
+		checkRate(pclk, 0);
+		checkRate(pclk, pclk / 16);
+		CHECK(UART_Port_GetBaud(&port) == pclk / 16);
+		checkRate(pclk, pclk / 16 + 1);
+		checkRate(pclk, low - 1);
+		checkRate(pclk, low);
+		CHECK(UART_Port_GetBaud(&port) != 0);
+		checkRate(pclk, UINT32_MAX);
+
+		for(i = 0; i < sizeof(standard) / sizeof(standard[0]); i++)
+			checkRate(pclk, standard[i]);
+		for(round = 0; round < ROUNDS; round++)
+			checkRate(pclk, rndRate(1, pclk / 8));
+	}
+}
+
+int main(int argc, char **argv) {
+	seed = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 0x5EED1234u;
+	rngState = seed ? seed : 1;
+
+	/* 72 MHz from the PLL as SystemClock_Config sets it up, then HSI alone */
+	testClocks(36000000, 72000000);
+	testClocks(8000000, 8000000);
+
+	/* At 72 MHz 1098 baud would need a divider past 16 bits, 1100 does not */
+	pclk2 = 72000000;
+	attach(USART1);
+	CHECK(UART_Port_CheckBaud(&port, 1098) == 0);
+	CHECK(UART_Port_CheckBaud(&port, 1100) != 0);
+	CHECK(UART_Port_SetBaud(&port, 9600) == 9600);
+	CHECK(USART1->BRR == 7500);
+
+	printf("test_uart_baud: seed %u: OK\n", seed);
+	return 0;
+}
@@ -0,0 +1,236 @@
+/*
+ * Simulated throttled link for the RTS side of UART_Port flow control.
+ * Src/uart_port.c runs unmodified against stub/stm32f1xx_hal.h; this file
+ * plays the USART, its RX DMA channel and the device at the other end.
+ * Time advances one character at a time, so the baud rate only enters
+ * through how many characters the peer still sends after RTS drops.
+ *
+ * The peer streams a known sequence as fast as the line allows while it
+ * sees RTS asserted. The main loop reads the RX ring in small bites with
+ * random stalls, well below line rate, and calls UART_Port_PollFlow after
+ * reading as src/main.c does. With flow control every character must
+ * arrive in order and the ring must never fill; without it the same link
+ * has to lose data, or the consumer was not slow enough to prove anything.
+ *
+ *   ./test_uart_flow [seed]
+ */
+#include "uart_port.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STREAM_LENGTH 300000
+#define LATENCY_MAX   256
+#define CHARS_PER_MS  450   /* 4.5 Mbaud, 10 bits per character */
+#define RTS_PIN       GPIO_PIN_12
+
+typedef struct {
+	const char *name;
+	UART_PortMode mode;
+	uint16_t rxSize;
+	uint16_t rxDmaSize;
+	uint16_t threshold;   /* 0: flow control off */
+	uint16_t latency;     /* characters the peer sends after RTS drops */
+} LinkCase;
+
+/* The rings and thresholds src/main.c gives each port */
+static const LinkCase cases[] = {
+	{ "USART1 DMA", UART_PORT_MODE_DMA, 1024, 256, 512, 64 },
+	{ "USART2 IRQ", UART_PORT_MODE_IRQ, 128, 0, 64, 16 },
+	{ "USART1 DMA", UART_PORT_MODE_DMA, 1024, 256, 0, 64 },
+	{ "USART2 IRQ", UART_PORT_MODE_IRQ, 128, 0, 0, 16 },
+};
+
+USART_TypeDef Sim_USART1;
+static GPIO_TypeDef gpio;
+static DMA_Channel_TypeDef rxChannel, txChannel;
+static DMA_HandleTypeDef hdmarx = { &rxChannel }, hdmatx = { &txChannel };
+static UART_HandleTypeDef huart;
+static UART_Port port;
+
+static uint8_t txStorage[64];
+static uint8_t rxStorage[1024];
+static uint8_t rxDmaStorage[256];
+static uint8_t *dmaBuf;
+static uint16_t dmaSize;
+static uint32_t now;   /* character times since the start of a case */
+
+static uint32_t seed, rngState;
+
+#define CHECK(cond) do { \
+		if(!(cond)) { \
+			fprintf(stderr, "%s:%d: %s failed (seed %u, char %u)\n", __FILE__, __LINE__, #cond, seed, now); \
+			exit(1); \
+		} \
+	} while(0)
+
+static uint32_t rnd(void) {
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState;
+}
+
+uint32_t HAL_GetTick(void) {
+	return now / CHARS_PER_MS;
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void) {
+	return 36000000;
+}
+
+uint32_t HAL_RCC_GetPCLK2Freq(void) {
+	return 72000000;
+}
+
+/* Only the receive side is simulated */
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *h, uint8_t *data, uint16_t size) {
+	(void)h;
+	(void)data;
+	(void)size;
+	return HAL_ERROR;
+}
+
+HAL_StatusTypeDef HAL_UART_AbortTransmit(UART_HandleTypeDef *h) {
+	(void)h;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef *h, uint8_t *data, uint16_t size) {
+	dmaBuf = data;
+	dmaSize = size;
+	rxChannel.CNDTR = size;
+	h->RxState = HAL_UART_STATE_BUSY_RX;
+	return HAL_OK;
+}
+
+/* The simulated line never raises an error, and the DMA events are delivered directly */
+void HAL_UART_IRQHandler(UART_HandleTypeDef *h) {
+	(void)h;
+}
+
+static uint8_t streamByte(uint32_t n) {
+	return (uint8_t)(n ^ (n >> 8) ^ (n >> 16));
+}
+
+/* Folds the driver's BSRR/BRR writes into the pin; 1 while RTS is deasserted */
+static uint8_t rtsHigh(void) {
+	gpio.ODR |= gpio.BSRR;
+	gpio.ODR &= ~gpio.BRR;
+	gpio.BSRR = gpio.BRR = 0;
+	return (gpio.ODR & RTS_PIN) != 0;
+}
+
+static void receiveChar(uint8_t byte) {
+	if(port.mode == UART_PORT_MODE_IRQ) {
+		Sim_USART1.DR = byte;
+		Sim_USART1.SR |= USART_SR_RXNE;
+		CHECK(Sim_USART1.CR1 & USART_CR1_RXNEIE);
+		UART_Port_IRQHandler(&port);
+		/* The handler's SR then DR read */
+		Sim_USART1.SR &= ~USART_SR_RXNE;
+		return;
+	}
+
+	/* Circular DMA: CNDTR reloads at the end and the transfer carries on */
+	dmaBuf[dmaSize - rxChannel.CNDTR] = byte;
+	if(--rxChannel.CNDTR == dmaSize / 2) {
+		HAL_UART_RxHalfCpltCallback(&huart);
+	} else if(rxChannel.CNDTR == 0) {
+		rxChannel.CNDTR = dmaSize;
+		HAL_UART_RxCpltCallback(&huart);
+	}
+}
+
+static void lineIdle(void) {
+	Sim_USART1.SR |= USART_SR_IDLE;
+	if(Sim_USART1.CR1 & USART_CR1_IDLEIE)
+		UART_Port_IRQHandler(&port);
+	Sim_USART1.SR &= ~USART_SR_IDLE;
+}
+
+static void runCase(const LinkCase *c) {
+	uint8_t history[LATENCY_MAX];
+	uint8_t chunk[16], lineBusy = 0;
+	uint32_t sent = 0, received = 0, paused = 0, stallUntil = 0;
+	uint16_t got, i;
+	RingBuffer_Stats stats;
+
+	memset(&Sim_USART1, 0, sizeof(Sim_USART1));
+	memset(&gpio, 0, sizeof(gpio));
+	memset(&rxChannel, 0, sizeof(rxChannel));
+	memset(history, 0, sizeof(history));
+	Sim_USART1.SR = USART_SR_TXE | USART_SR_TC;
+	Sim_USART1.BRR = UART_BRR_SAMPLING16(72000000, 4500000);
+	huart.Instance = USART1;
+	huart.Init.BaudRate = 4500000;
+	huart.Init.HwFlowCtl = UART_HWCONTROL_NONE;
+	huart.hdmarx = &hdmarx;
+	huart.hdmatx = &hdmatx;
+	huart.RxState = HAL_UART_STATE_READY;
+	huart.ErrorCode = HAL_UART_ERROR_NONE;
+
+	UART_Port_Init(&port, &huart, c->mode, txStorage, sizeof(txStorage), rxStorage, c->rxSize,
+			c->mode == UART_PORT_MODE_DMA ? rxDmaStorage : NULL, c->rxDmaSize);
+	CHECK(port.mode == c->mode);
+	if(c->threshold)
+		UART_Port_SetFlowControl(&port, &gpio, RTS_PIN, c->threshold);
+	UART_Port_Start(&port);
+
+	for(now = 0; sent < STREAM_LENGTH || lineBusy || RingBuffer_GetDataLength(&port.rx) > 0; now++) {
+		CHECK(now < 100 * STREAM_LENGTH);
+
+		/* The peer acts on the RTS level of latency characters ago */
+		history[now % LATENCY_MAX] = rtsHigh();
+		if(sent < STREAM_LENGTH && !history[(now + LATENCY_MAX - c->latency) % LATENCY_MAX]) {
+			receiveChar(streamByte(sent++));
+			lineBusy = 1;
+		} else {
+			if(sent < STREAM_LENGTH)
+				paused++;
+			if(lineBusy)
+				lineIdle();
+			lineBusy = 0;
+		}
+
+		/* Main loop: a pass every few characters, a few bytes a pass, now and then a long stall */
+		if(now < stallUntil || now % 4 != 0)
+			continue;
+		if(rnd() % 512 == 0)
+			stallUntil = now + rnd() % 4096;
+		got = UART_Port_Read(&port, chunk, 1 + rnd() % 4);
+		for(i = 0; i < got; i++, received++) {
+			if(c->threshold)
+				CHECK(chunk[i] == streamByte(received));
+		}
+		UART_Port_PollFlow(&port);
+	}
+
+	RingBuffer_GetStats(&port.rx, &stats);
+	printf("  %s, flow control %-3s: %6u of %u received, %4u RTS stops, peak fill %4u of %u\n",
+			c->name, c->threshold ? "on" : "off", received, sent, port.flow.stops,
+			stats.highWater, c->rxSize);
+	if(c->threshold) {
+		CHECK(received == STREAM_LENGTH);
+		CHECK(stats.rejectedWrites == 0);
+		CHECK(stats.highWater < c->rxSize);
+		CHECK(port.flow.stops > 0 && paused > 0);
+		CHECK(!rtsHigh());
+	} else {
+		CHECK(received < STREAM_LENGTH);
+		CHECK(stats.rejectedWrites > 0);
+	}
+}
+
+int main(int argc, char **argv) {
+	uint32_t i;
+
+	seed = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 0x5EED1234u;
+	rngState = seed ? seed : 1;
+
+	printf("test_uart_flow: seed %u\n", seed);
+	for(i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+		runCase(&cases[i]);
+	printf("test_uart_flow: OK\n");
+	return 0;
+}